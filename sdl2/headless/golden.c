@@ -0,0 +1,260 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021 Antonio Niño Díaz
+
+// Hashes of the state of the simulation and golden file handling. The golden
+// file has one entry per line:
+//
+//     scenario steps seed disasters edits traffic_batched initial_map map
+//     traffic power services pollution happiness
+//
+// All hashes are 64-bit FNV-1a values printed in hexadecimal. Lines starting
+// with '#' are comments.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "room_game/draw_common.h"
+#include "room_game/room_game.h"
+#include "simulation/happiness.h"
+#include "simulation/pollution.h"
+#include "simulation/power.h"
+#include "simulation/services.h"
+#include "simulation/traffic.h"
+
+#include "golden.h"
+
+#define MAX_LINE_LENGTH     512
+#define MAX_LINES           256
+
+static const char *hash_names[HASH_NUMBER] = {
+    [HASH_MAP] = "map",
+    [HASH_TRAFFIC] = "traffic",
+    [HASH_POWER] = "power",
+    [HASH_SERVICES] = "services",
+    [HASH_POLLUTION] = "pollution",
+    [HASH_HAPPINESS] = "happiness",
+};
+
+#define FNV_OFFSET_BASIS    0xCBF29CE484222325ULL
+#define FNV_PRIME           0x00000100000001B3ULL
+
+static uint64_t Hash_Bytes(uint64_t hash, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static uint64_t Hash_Buffer(const uint8_t *data)
+{
+    return Hash_Bytes(FNV_OFFSET_BASIS, data,
+                      CITY_MAP_WIDTH * CITY_MAP_HEIGHT);
+}
+
+uint64_t Golden_HashMap(void)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    // Hash the tiles in little endian order so that the result doesn't depend
+    // on the host or on how the map is stored.
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        {
+            uint16_t tile = CityMapGetTile(i, j);
+            uint8_t bytes[2] = { tile & 0xFF, tile >> 8 };
+            hash = Hash_Bytes(hash, bytes, sizeof(bytes));
+        }
+    }
+
+    return hash;
+}
+
+void Golden_HashState(golden_state *state)
+{
+    state->hash[HASH_MAP] = Golden_HashMap();
+    state->hash[HASH_TRAFFIC] = Hash_Buffer(Simulation_TrafficGetMap());
+    state->hash[HASH_POWER] = Hash_Buffer(Simulation_PowerDistributionGetMap());
+    state->hash[HASH_SERVICES] = Hash_Buffer(Simulation_ServicesGetMap());
+    state->hash[HASH_POLLUTION] = Hash_Buffer(Simulation_PollutionGetMap());
+    state->hash[HASH_HAPPINESS] = Hash_Buffer(Simulation_HappinessGetMap());
+}
+
+void Golden_Print(const golden_state *state)
+{
+    printf("Initial map: %016" PRIx64 "\n", state->initial_map);
+    for (int i = 0; i < HASH_NUMBER; i++)
+        printf("%-12s %016" PRIx64 "\n", hash_names[i], state->hash[i]);
+}
+
+static int Golden_FormatLine(char *line, size_t size,
+                             const golden_state *state)
+{
+    return snprintf(line, size,
+                    "%d %ld %" PRIu64 " %d %d %d %016" PRIx64 " %016" PRIx64
+                    " %016" PRIx64 " %016" PRIx64 " %016" PRIx64
+                    " %016" PRIx64 " %016" PRIx64 "\n",
+                    state->scenario, state->steps, state->seed,
+                    state->disasters, state->edits, state->traffic_batched,
+                    state->initial_map,
+                    state->hash[HASH_MAP], state->hash[HASH_TRAFFIC],
+                    state->hash[HASH_POWER], state->hash[HASH_SERVICES],
+                    state->hash[HASH_POLLUTION], state->hash[HASH_HAPPINESS]);
+}
+
+// Returns 1 if the line has been parsed successfully
+static int Golden_ParseLine(const char *line, golden_state *state)
+{
+    if ((line[0] == '#') || (line[0] == '\n') || (line[0] == '\0'))
+        return 0;
+
+    char *end;
+
+    state->scenario = strtol(line, &end, 10);
+    state->steps = strtol(end, &end, 10);
+    state->seed = strtoull(end, &end, 10);
+    state->disasters = strtol(end, &end, 10);
+    state->edits = strtol(end, &end, 10);
+    state->traffic_batched = strtol(end, &end, 10);
+    state->initial_map = strtoull(end, &end, 16);
+    for (int i = 0; i < HASH_NUMBER; i++)
+        state->hash[i] = strtoull(end, &end, 16);
+
+    while ((*end == ' ') || (*end == '\r') || (*end == '\n'))
+        end++;
+
+    return *end == '\0';
+}
+
+static int Golden_SameRun(const golden_state *a, const golden_state *b)
+{
+    return (a->scenario == b->scenario) && (a->steps == b->steps) &&
+           (a->seed == b->seed) && (a->disasters == b->disasters) &&
+           (a->edits == b->edits) &&
+           (a->traffic_batched == b->traffic_batched);
+}
+
+int Golden_Check(const char *path, const golden_state *state)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        printf("Can't open golden file: %s\n", path);
+        return GOLDEN_MISSING;
+    }
+
+    static char line[MAX_LINE_LENGTH];
+    golden_state golden;
+    int found = 0;
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (Golden_ParseLine(line, &golden) == 0)
+            continue;
+
+        if (Golden_SameRun(&golden, state))
+        {
+            found = 1;
+            break;
+        }
+    }
+
+    fclose(f);
+
+    if (!found)
+    {
+        printf("No golden values for this run. Use --update-golden.\n");
+        return GOLDEN_MISSING;
+    }
+
+    // If the map isn't the same the rest of the hashes can't match either, but
+    // this message is more useful.
+    if (golden.initial_map != state->initial_map)
+    {
+        printf("The initial map doesn't match the one used to generate the "
+               "golden values (%016" PRIx64 " != %016" PRIx64 "). The "
+               "assets may have been converted differently. Use "
+               "--update-golden.\n", state->initial_map, golden.initial_map);
+        return GOLDEN_MISMATCH;
+    }
+
+    int ret = GOLDEN_OK;
+
+    for (int i = 0; i < HASH_NUMBER; i++)
+    {
+        if (golden.hash[i] != state->hash[i])
+        {
+            printf("Mismatch in %s: %016" PRIx64 " (expected %016" PRIx64
+                   ")\n", hash_names[i], state->hash[i], golden.hash[i]);
+            ret = GOLDEN_MISMATCH;
+        }
+    }
+
+    return ret;
+}
+
+int Golden_Update(const char *path, const golden_state *state)
+{
+    static char lines[MAX_LINES][MAX_LINE_LENGTH];
+    int num_lines = 0;
+    int replaced = 0;
+
+    FILE *f = fopen(path, "r");
+    if (f != NULL)
+    {
+        while (num_lines < MAX_LINES)
+        {
+            char *line = lines[num_lines];
+
+            if (fgets(line, MAX_LINE_LENGTH, f) == NULL)
+                break;
+
+            golden_state golden;
+            if (Golden_ParseLine(line, &golden))
+            {
+                if (Golden_SameRun(&golden, state))
+                {
+                    Golden_FormatLine(line, MAX_LINE_LENGTH, state);
+                    replaced = 1;
+                }
+            }
+
+            num_lines++;
+        }
+
+        fclose(f);
+    }
+
+    if (!replaced)
+    {
+        if (num_lines == MAX_LINES)
+        {
+            printf("Too many lines in golden file: %s\n", path);
+            return -1;
+        }
+
+        Golden_FormatLine(lines[num_lines], MAX_LINE_LENGTH, state);
+        num_lines++;
+    }
+
+    f = fopen(path, "w");
+    if (f == NULL)
+    {
+        printf("Can't open golden file: %s\n", path);
+        return -1;
+    }
+
+    for (int i = 0; i < num_lines; i++)
+        fputs(lines[i], f);
+
+    fclose(f);
+
+    return 0;
+}
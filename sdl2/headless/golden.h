@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021 Antonio Niño Díaz
+
+#ifndef HEADLESS_GOLDEN_H__
+#define HEADLESS_GOLDEN_H__
+
+#include <stdint.h>
+
+// Return values of Golden_Check()
+#define GOLDEN_OK           0
+#define GOLDEN_MISMATCH     1
+#define GOLDEN_MISSING      2
+
+typedef enum {
+    HASH_MAP,
+    HASH_TRAFFIC,
+    HASH_POWER,
+    HASH_SERVICES,
+    HASH_POLLUTION,
+    HASH_HAPPINESS,
+
+    HASH_NUMBER
+} hash_type;
+
+typedef struct {
+    // Parameters of the run
+    int scenario;
+    long steps;
+    uint64_t seed;
+    int disasters;
+    int edits; // Map edits done during the run, like a player would do
+    int traffic_batched;
+
+    // Hash of the map right after loading it. It is used to detect if the
+    // assets have been converted in a different way than the ones used to
+    // generate the golden values.
+    uint64_t initial_map;
+
+    uint64_t hash[HASH_NUMBER];
+} golden_state;
+
+// Calculate the hash of the map (only used to fill `initial_map`)
+uint64_t Golden_HashMap(void);
+
+// Calculate the hashes of the current state of the simulation
+void Golden_HashState(golden_state *state);
+
+void Golden_Print(const golden_state *state);
+
+// Compare the state against the entry of the golden file with the same run
+// parameters. Returns GOLDEN_MISSING if there is no entry for this run.
+int Golden_Check(const char *path, const golden_state *state);
+
+// Add or replace the entry with the same run parameters. Returns 0 on success.
+int Golden_Update(const char *path, const golden_state *state);
+
+#endif // HEADLESS_GOLDEN_H__
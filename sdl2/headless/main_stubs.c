@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021 Antonio Niño Díaz
+
+// Functions normally defined in main.c. The headless tools don't have rooms,
+// so they don't need to do anything.
+
+#include "main.h"
+
+void Game_Clear_Screen(void)
+{
+}
+
+void Game_Room_Prepare_Switch(room_type new_room)
+{
+    (void)new_room;
+}
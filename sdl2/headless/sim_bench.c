@@ -0,0 +1,459 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021 Antonio Niño Díaz
+
+// Microbenchmarks of the simulation kernels. Each case builds a synthetic
+// worst-case city, refreshes the state of the simulation once, and then calls
+// the kernel repeatedly.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ugba/ugba.h>
+
+#include "date.h"
+#include "random.h"
+#include "room_game/building_info.h"
+#include "room_game/draw_building.h"
+#include "room_game/draw_common.h"
+#include "room_game/draw_road.h"
+#include "room_game/room_game.h"
+#include "room_game/text_messages.h"
+#include "room_game/tileset_info.h"
+#include "room_gen_map/generate_map.h"
+#include "simulation/building_count.h"
+#include "simulation/calculate_stats.h"
+#include "simulation/common.h"
+#include "simulation/fire.h"
+#include "simulation/pollution.h"
+#include "simulation/power.h"
+#include "simulation/services.h"
+#include "simulation/technology.h"
+#include "simulation/traffic.h"
+
+#define DEFAULT_ITERATIONS      200
+
+#define MAP_TILES               (CITY_MAP_WIDTH * CITY_MAP_HEIGHT)
+
+// Synthetic maps
+// ==============
+
+typedef enum {
+    // Road lattice with a road every 4 tiles. The 3x3 blocks between roads
+    // have dense residential, commercial and industrial buildings, and a few
+    // service buildings.
+    BENCH_MAP_ROAD_GRID,
+
+    // The whole map is covered by 3x3 buildings without any gaps between them,
+    // so all of them are part of the same power grid. There are several power
+    // plants and service buildings.
+    BENCH_MAP_DENSE_BLOCKS,
+} bench_map;
+
+static uint16_t empty_map[MAP_TILES];
+
+static void Bench_Load_Empty_Map(void)
+{
+    for (int i = 0; i < MAP_TILES; i++)
+        empty_map[i] = T_GRASS;
+
+    Room_Game_Load_City(empty_map, "Benchmark", 0, 0);
+    Room_Game_Set_City_Date(0, 2000);
+    Simulation_SetCityClass(CLASS_CAPITAL);
+    Technology_SetLevel(TECH_LEVEL_MAX);
+    Room_Game_SetDisasterMode(0);
+    Simulation_DisastersSetEnabled(0);
+}
+
+// Building of block (bx, by). Most of them are residential.
+static int Bench_Block_Building(int bx, int by)
+{
+    static const struct {
+        int bx, by, type;
+    } special[] = {
+        { 2, 2, B_PoliceDept }, { 9, 4, B_PoliceDept }, { 5, 12, B_PoliceDept },
+        { 6, 6, B_FireDept }, { 13, 10, B_FireDept },
+        { 3, 9, B_Hospital }, { 11, 13, B_Hospital },
+        { 7, 2, B_School }, { 1, 13, B_School }, { 12, 7, B_School },
+        { 8, 9, B_HighSchool }, { 4, 4, B_HighSchool },
+    };
+
+    for (size_t i = 0; i < sizeof(special) / sizeof(special[0]); i++)
+    {
+        if ((special[i].bx == bx) && (special[i].by == by))
+            return special[i].type;
+    }
+
+    switch ((bx + 2 * by) % 5)
+    {
+        case 1:
+            return B_CommercialS3D;
+        case 3:
+            return B_IndustrialS3D;
+        default:
+            return B_ResidentialS3D;
+    }
+}
+
+static void Bench_Build_Road_Grid(void)
+{
+    Bench_Load_Empty_Map();
+
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        {
+            if (((i % 4) == 0) || ((j % 4) == 0))
+                MapDrawRoad(1, i, j);
+        }
+    }
+
+    for (int by = 0; by < CITY_MAP_HEIGHT / 4; by++)
+    {
+        for (int bx = 0; bx < CITY_MAP_WIDTH / 4; bx++)
+        {
+            int type = Bench_Block_Building(bx, by);
+            MapDrawBuilding(1, type, bx * 4 + 1, by * 4 + 1);
+        }
+    }
+}
+
+static void Bench_Build_Dense_Blocks(void)
+{
+    Bench_Load_Empty_Map();
+
+    // Power plants in a 4x4 grid of 16x16 cells, one per cell corner
+
+    static const int plants[] = {
+        B_PowerPlantCoal, B_PowerPlantOil, B_PowerPlantNuclear,
+        B_PowerPlantFusion
+    };
+
+    for (int j = 0; j < 4; j++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            int type = plants[(i + j) % 4];
+            MapDrawBuilding(1, type, i * 16 + 6, j * 16 + 6);
+        }
+    }
+
+    // Fill the rest of the map with 3x3 buildings. Skip any block that
+    // overlaps a power plant.
+
+    for (int by = 0; by < (CITY_MAP_HEIGHT + 2) / 3; by++)
+    {
+        for (int bx = 0; bx < (CITY_MAP_WIDTH + 2) / 3; bx++)
+        {
+            int x = bx * 3;
+            int y = by * 3;
+
+            int free = 1;
+
+            for (int dy = 0; (dy < 3) && free; dy++)
+            {
+                for (int dx = 0; dx < 3; dx++)
+                {
+                    int i = x + dx;
+                    int j = y + dy;
+
+                    if ((i >= CITY_MAP_WIDTH) || (j >= CITY_MAP_HEIGHT))
+                        continue;
+
+                    if (CityMapGetType(i, j) != TYPE_FIELD)
+                    {
+                        free = 0;
+                        break;
+                    }
+                }
+            }
+
+            if (!free)
+                continue;
+
+            int type = Bench_Block_Building(bx % 16, by % 16);
+
+            const building_info *info = Get_Building_Info(type);
+            if ((x + info->width > CITY_MAP_WIDTH) ||
+                (y + info->height > CITY_MAP_HEIGHT))
+            {
+                type = B_ResidentialS1D;
+                int w = CITY_MAP_WIDTH - x;
+                int h = CITY_MAP_HEIGHT - y;
+                if (w > 3)
+                    w = 3;
+                if (h > 3)
+                    h = 3;
+
+                for (int dy = 0; dy < h; dy++)
+                {
+                    for (int dx = 0; dx < w; dx++)
+                        MapDrawBuilding(1, type, x + dx, y + dy);
+                }
+                continue;
+            }
+
+            MapDrawBuilding(1, type, x, y);
+        }
+    }
+}
+
+// Load the map and refresh the state of the simulation once so that all the
+// inputs of the kernels are valid.
+static void Bench_Prepare(bench_map map)
+{
+    rand_fast_set_seed(RAND_FAST_DEFAULT_SEED);
+    rand_slow_set_seed(0x5EED);
+
+    switch (map)
+    {
+        case BENCH_MAP_ROAD_GRID:
+            Bench_Build_Road_Grid();
+            break;
+        case BENCH_MAP_DENSE_BLOCKS:
+            Bench_Build_Dense_Blocks();
+            break;
+        default:
+            UGBA_Assert(0);
+            break;
+    }
+
+    Simulation_CountBuildings();
+    Simulation_SimulateAll();
+
+    while (MessageQueueIsEmpty() == 0)
+        (void)MessageQueueGet();
+}
+
+// Benchmark cases
+// ===============
+
+static uint64_t Bench_Time_ns(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void Bench_Traffic(void)
+{
+    Simulation_Traffic();
+}
+
+static void Bench_TrafficBatched(void)
+{
+    Simulation_TrafficSetBatched(1);
+    Simulation_Traffic();
+    Simulation_TrafficSetBatched(0);
+}
+
+static void Bench_PowerDistribution(void)
+{
+    Simulation_PowerDistribution();
+}
+
+static void Bench_PowerDistributionFull(void)
+{
+    // Discard the cached state so that the whole map is handled
+    PowerGridRefresh();
+    Simulation_PowerDistribution();
+}
+
+static void Bench_ServicesPolice(void)
+{
+    Simulation_Services(T_POLICE_DEPT_CENTER);
+}
+
+static void Bench_ServicesBig(void)
+{
+    Simulation_ServicesBig(T_HIGH_SCHOOL_CENTER);
+}
+
+static void Bench_ServicesAll(void)
+{
+    Simulation_ServicesAll((1 << SERVICE_NUMBER) - 1);
+}
+
+static void Bench_Pollution(void)
+{
+    Simulation_Pollution();
+}
+
+static void Bench_Fire_Prepare(void)
+{
+    Bench_Prepare(BENCH_MAP_DENSE_BLOCKS);
+    Simulation_FireTryStart(1);
+}
+
+static void Bench_Fire_Restart(void)
+{
+    // Restart the fire if it has been extinguished
+    if (!Room_Game_IsInDisasterMode())
+        Bench_Fire_Prepare();
+}
+
+static void Bench_Fire(void)
+{
+    Simulation_Fire();
+}
+
+static void Bench_GenerateMap(void)
+{
+    static int seed = 0;
+
+    Generate_Map(seed & 0xFF, (seed >> 8) & 0xFF, 0);
+
+    seed++;
+}
+
+typedef struct {
+    const char *name;
+    bench_map map;
+    void (*prepare)(void); // If NULL, Bench_Prepare(map) is used
+    void (*run)(void);
+    // If not NULL, it's called before each call to run(), and it isn't
+    // included in the measurement.
+    void (*restart)(void);
+} bench_case;
+
+static const bench_case cases[] = {
+    { "traffic", BENCH_MAP_ROAD_GRID, NULL, Bench_Traffic, NULL },
+    { "traffic_batched", BENCH_MAP_ROAD_GRID, NULL, Bench_TrafficBatched,
+      NULL },
+    { "power", BENCH_MAP_DENSE_BLOCKS, NULL, Bench_PowerDistribution, NULL },
+    { "power_full", BENCH_MAP_DENSE_BLOCKS, NULL, Bench_PowerDistributionFull,
+      NULL },
+    { "services_police", BENCH_MAP_DENSE_BLOCKS, NULL, Bench_ServicesPolice,
+      NULL },
+    { "services_big", BENCH_MAP_DENSE_BLOCKS, NULL, Bench_ServicesBig, NULL },
+    { "services_all", BENCH_MAP_DENSE_BLOCKS, NULL, Bench_ServicesAll, NULL },
+    { "pollution", BENCH_MAP_ROAD_GRID, NULL, Bench_Pollution, NULL },
+    { "fire", BENCH_MAP_DENSE_BLOCKS, Bench_Fire_Prepare, Bench_Fire,
+      Bench_Fire_Restart },
+    { "generate_map", BENCH_MAP_ROAD_GRID, NULL, Bench_GenerateMap, NULL },
+};
+
+#define NUM_CASES   (int)(sizeof(cases) / sizeof(cases[0]))
+
+static void Bench_Run(const bench_case *c, int iterations)
+{
+    if (c->prepare)
+        c->prepare();
+    else
+        Bench_Prepare(c->map);
+
+    // Warm up caches
+    c->run();
+
+    uint64_t elapsed = 0;
+
+    if (c->restart)
+    {
+        // Time each call on its own so that the restarts aren't measured
+        for (int i = 0; i < iterations; i++)
+        {
+            c->restart();
+
+            uint64_t start = Bench_Time_ns();
+            c->run();
+            elapsed += Bench_Time_ns() - start;
+        }
+    }
+    else
+    {
+        uint64_t start = Bench_Time_ns();
+
+        for (int i = 0; i < iterations; i++)
+            c->run();
+
+        elapsed = Bench_Time_ns() - start;
+    }
+
+    double ns_per_call = (double)elapsed / iterations;
+
+    printf("%-18s %10d %14.0f %12.2f\n", c->name, iterations, ns_per_call,
+           ns_per_call / MAP_TILES);
+}
+
+static void Print_Usage(const char *name)
+{
+    printf("Usage: %s [options] [case...]\n"
+           "\n"
+           "Options:\n"
+           "  --iterations <n>   Calls to each kernel (default: %d)\n"
+           "  --list             List all cases and exit\n"
+           "  --help             Show this message and exit\n"
+           "\n"
+           "If no case is specified, all of them are run.\n",
+           name, DEFAULT_ITERATIONS);
+}
+
+int main(int argc, char *argv[])
+{
+    UGBA_InitHeadless(&argc, &argv);
+
+    int iterations = DEFAULT_ITERATIONS;
+    int selected[NUM_CASES] = { 0 };
+    int any_selected = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--help") == 0)
+        {
+            Print_Usage(argv[0]);
+            return 0;
+        }
+        else if (strcmp(argv[i], "--list") == 0)
+        {
+            for (int c = 0; c < NUM_CASES; c++)
+                printf("%s\n", cases[c].name);
+            return 0;
+        }
+        else if ((strcmp(argv[i], "--iterations") == 0) && (i + 1 < argc))
+        {
+            iterations = strtol(argv[++i], NULL, 0);
+            if (iterations <= 0)
+            {
+                printf("Invalid number of iterations\n");
+                return 1;
+            }
+        }
+        else
+        {
+            int found = 0;
+            for (int c = 0; c < NUM_CASES; c++)
+            {
+                if (strcmp(argv[i], cases[c].name) == 0)
+                {
+                    selected[c] = 1;
+                    found = 1;
+                }
+            }
+
+            if (!found)
+            {
+                printf("Invalid argument: %s\n\n", argv[i]);
+                Print_Usage(argv[0]);
+                return 1;
+            }
+
+            any_selected = 1;
+        }
+    }
+
+    printf("%-18s %10s %14s %12s\n", "case", "iterations", "ns/call",
+           "ns/tile");
+
+    for (int c = 0; c < NUM_CASES; c++)
+    {
+        if (any_selected && !selected[c])
+            continue;
+
+        Bench_Run(&cases[c], iterations);
+    }
+
+    return 0;
+}
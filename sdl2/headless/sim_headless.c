@@ -0,0 +1,477 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021 Antonio Niño Díaz
+
+// Headless simulation runner. It loads one of the scenarios of the game and
+// runs the simulation as fast as possible, without a window and without
+// waiting for the VBL interrupt. This is useful to measure the throughput of
+// the simulation and to run many years of simulation in CI.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ugba/ugba.h>
+
+#include "date.h"
+#include "money.h"
+#include "random.h"
+#include "room_game/building_info.h"
+#include "room_game/draw_building.h"
+#include "room_game/draw_common.h"
+#include "room_game/room_game.h"
+#include "room_game/text_messages.h"
+#include "room_scenarios/room_scenarios.h"
+#include "simulation/building_count.h"
+#include "simulation/calculate_stats.h"
+#include "simulation/common.h"
+#include "simulation/happiness.h"
+#include "simulation/power.h"
+#include "simulation/profile.h"
+#include "simulation/traffic.h"
+
+#include "golden.h"
+
+#define DEFAULT_SCENARIO        "Central"
+#define DEFAULT_STEPS           120
+#define DEFAULT_SEED            0x5EED
+
+static void Print_Usage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+           "\n"
+           "Options:\n"
+           "  --scenario <name|index>  Scenario to simulate (default: %s)\n"
+           "  --steps <n>              Months to simulate (default: %d)\n"
+           "  --seed <n>               Seed of the RNG (default: %d)\n"
+           "  --disasters              Enable random disasters\n"
+           "  --edits                  Build and demolish like a player would\n"
+           "  --traffic-batched        Simulate traffic in batched mode\n"
+           "  --compare-traffic <max>  Simulate with and without batched traffic,\n"
+           "                           print the differences and fail if the\n"
+           "                           population differs more than <max>%%\n"
+           "  --hash                   Print hashes of the final state\n"
+           "  --check-golden <path>    Compare the final state against a golden\n"
+           "                           file\n"
+           "  --update-golden <path>   Save the final state to a golden file\n"
+           "  --profile-csv <path>     Save timings of each simulation phase\n"
+           "                           (requires ENABLE_SIM_PROFILE)\n"
+           "  --list                   List all scenarios and exit\n"
+           "  --help                   Show this message and exit\n",
+           name, DEFAULT_SCENARIO, DEFAULT_STEPS, DEFAULT_SEED);
+}
+
+static void List_Scenarios(void)
+{
+    for (int i = 0; i < Room_Scenarios_Get_Number(); i++)
+        printf("%d: %s\n", i, Room_Scenarios_Get_Name(i));
+}
+
+// Returns -1 if the scenario isn't found
+static int Find_Scenario(const char *str)
+{
+    char *end;
+    long index = strtol(str, &end, 0);
+    if ((*end == '\0') && (end != str))
+    {
+        if ((index >= 0) && (index < Room_Scenarios_Get_Number()))
+            return index;
+        return -1;
+    }
+
+    for (int i = 0; i < Room_Scenarios_Get_Number(); i++)
+    {
+        if (strcmp(Room_Scenarios_Get_Name(i), str) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static double Get_Time_Seconds(void)
+{
+    return (double)clock() / (double)CLOCKS_PER_SEC;
+}
+
+// Discard all messages generated by the simulation. The game would normally
+// show them in the notification box before doing the next simulation step.
+static void Flush_Messages(void)
+{
+    while (MessageQueueIsEmpty() == 0)
+        (void)MessageQueueGet();
+}
+
+// Number of months between two sets of edits of the map, and number of edits
+// in each set.
+#define EDITS_PERIOD            6
+#define EDITS_PER_PERIOD        4
+
+// Buildings that the player can build, and which touch all the systems that
+// keep state from one step to the next.
+static const int edit_types[] = {
+    B_Residential, B_Commercial, B_Industrial, B_PoliceDept, B_FireDept,
+    B_Hospital, B_ParkSmall, B_School, B_PowerPlantCoal, B_PowerPlantWind,
+    B_Road, B_Train, B_PowerLines,
+};
+
+#define NUM_EDIT_TYPES  (sizeof(edit_types) / sizeof(edit_types[0]))
+
+// The edits use their own generator so that they don't change the sequence of
+// random numbers of the simulation.
+static uint32_t edits_rand_state;
+
+static uint32_t Edits_Rand(void)
+{
+    // xorshift32
+    uint32_t x = edits_rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    edits_rand_state = x;
+    return x;
+}
+
+// Build and demolish buildings in random places of the map, going through the
+// same checks of money and free space as the edits of the player.
+static void Do_Edits(void)
+{
+    for (int i = 0; i < EDITS_PER_PERIOD; i++)
+    {
+        uint32_t r = Edits_Rand();
+
+        if (r & 1)
+        {
+            // The cursor of the game doesn't let the player place buildings
+            // that don't fit in the map, and MapDrawBuilding() relies on it.
+            int type = edit_types[(r >> 1) % NUM_EDIT_TYPES];
+            const building_info *bi = Get_Building_Info(type);
+
+            int x = (r >> 8) % (CITY_MAP_WIDTH - bi->width + 1);
+            int y = (r >> 16) % (CITY_MAP_HEIGHT - bi->height + 1);
+
+            Building_Build(0, type, x, y);
+        }
+        else
+        {
+            int x = (r >> 8) % CITY_MAP_WIDTH;
+            int y = (r >> 16) % CITY_MAP_HEIGHT;
+
+            // Building_Remove() doesn't expect to be called on empty tiles.
+            // The game doesn't let the player do it either.
+            if (CityMapGetType(x, y) != TYPE_FIELD)
+                Building_Remove(0, x, y);
+        }
+    }
+
+    // This is done by the game when leaving the edit mode
+    Simulation_CountBuildings();
+}
+
+// Load the scenario and simulate it. Returns the time spent in the simulation
+// steps, in seconds.
+static double Run_Simulation(int scenario, long steps, uint64_t seed,
+                             int disasters, int edits, int traffic_batched,
+                             uint64_t *initial_map)
+{
+    // Make the results of the simulation reproducible
+
+    rand_fast_set_seed(RAND_FAST_DEFAULT_SEED);
+
+    Room_Scenarios_Setup_City(scenario);
+
+    // A fire may still be active if a city has been simulated before
+    Room_Game_SetDisasterMode(0);
+
+    rand_slow_set_seed(seed);
+    edits_rand_state = (uint32_t)seed | 1; // The state can't be 0
+
+    Simulation_DisastersSetEnabled(disasters);
+    Simulation_TrafficSetBatched(traffic_batched);
+
+    *initial_map = Golden_HashMap();
+
+    // This is done by Room_Game_Load() in the game
+    Simulation_CountBuildings();
+
+    // The first step only refreshes the state of the city after loading it. It
+    // doesn't advance the date, so don't count it.
+
+    Simulation_SimulateAll();
+    Flush_Messages();
+
+    double start = Get_Time_Seconds();
+
+    for (long i = 0; i < steps; i++)
+    {
+        if (edits && ((i % EDITS_PERIOD) == 0))
+            Do_Edits();
+
+        Simulation_SimulateAll();
+        Flush_Messages();
+    }
+
+    return Get_Time_Seconds() - start;
+}
+
+// Results of the simulation used to compare the two modes of the traffic
+// simulation.
+typedef struct {
+    unsigned int population;
+    int traffic_jam_percent;
+    uint64_t traffic_ok[CITY_MAP_HEIGHT];
+} traffic_mode_result;
+
+static void Traffic_Mode_Result_Get(traffic_mode_result *r)
+{
+    r->population = Simulation_GetTotalPopulation();
+    r->traffic_jam_percent = Simulation_TrafficGetTrafficJamPercent();
+
+    const uint64_t *plane = Simulation_HappinessGetPlane(TILE_OK_TRAFFIC_BIT);
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+        r->traffic_ok[j] = plane[j];
+}
+
+// Simulate the scenario handling the traffic of one building at a time and in
+// batched mode, and print how far the results are. Returns 1 if the population
+// differs more than the specified percentage, 0 otherwise.
+static int Compare_Traffic_Modes(int scenario, long steps, uint64_t seed,
+                                 int disasters, int edits,
+                                 int max_population_diff)
+{
+    static traffic_mode_result single, batched;
+    uint64_t initial_map;
+
+    Run_Simulation(scenario, steps, seed, disasters, edits, 0, &initial_map);
+    Traffic_Mode_Result_Get(&single);
+
+    Run_Simulation(scenario, steps, seed, disasters, edits, 1, &initial_map);
+    Traffic_Mode_Result_Get(&batched);
+
+    int flags_diff = 0;
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        flags_diff += __builtin_popcountll(single.traffic_ok[j] ^
+                                           batched.traffic_ok[j]);
+    }
+
+    double population_diff = 0.0;
+    if (single.population > 0)
+    {
+        population_diff = 100.0 * ((double)batched.population -
+                                   (double)single.population) /
+                          (double)single.population;
+    }
+    else if (batched.population > 0)
+    {
+        population_diff = 100.0;
+    }
+
+    printf("Scenario:    %s\n", Room_Scenarios_Get_Name(scenario));
+    printf("Months:      %ld\n", steps);
+    printf("Traffic:     one building at a time -> batched\n");
+    printf("Population:  %u -> %u (%+.1f%%)\n", single.population,
+           batched.population, population_diff);
+    printf("Traffic jam: %d%% -> %d%%\n", single.traffic_jam_percent,
+           batched.traffic_jam_percent);
+    printf("Traffic ok:  %d tiles (%.1f%%) have a different flag\n",
+           flags_diff,
+           100.0 * flags_diff / (CITY_MAP_WIDTH * CITY_MAP_HEIGHT));
+
+    if ((population_diff > max_population_diff) ||
+        (population_diff < -max_population_diff))
+    {
+        printf("The population differs more than %d%%\n",
+               max_population_diff);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    UGBA_InitHeadless(&argc, &argv);
+
+    const char *scenario_name = DEFAULT_SCENARIO;
+    long steps = DEFAULT_STEPS;
+    uint64_t seed = DEFAULT_SEED;
+    int disasters = 0;
+    int edits = 0;
+    int traffic_batched = 0;
+    int compare_traffic = -1;
+    int print_hash = 0;
+    const char *check_golden_path = NULL;
+    const char *update_golden_path = NULL;
+    const char *profile_csv_path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--help") == 0)
+        {
+            Print_Usage(argv[0]);
+            return 0;
+        }
+        else if (strcmp(argv[i], "--list") == 0)
+        {
+            List_Scenarios();
+            return 0;
+        }
+        else if ((strcmp(argv[i], "--scenario") == 0) && (i + 1 < argc))
+        {
+            scenario_name = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--steps") == 0) && (i + 1 < argc))
+        {
+            steps = strtol(argv[++i], NULL, 0);
+            if (steps < 0)
+            {
+                printf("Invalid number of steps: %ld\n", steps);
+                return 1;
+            }
+        }
+        else if ((strcmp(argv[i], "--seed") == 0) && (i + 1 < argc))
+        {
+            seed = strtoull(argv[++i], NULL, 0);
+            if (seed == 0)
+            {
+                // The state of xorshift generators can't be 0
+                printf("The seed can't be 0\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--disasters") == 0)
+        {
+            disasters = 1;
+        }
+        else if (strcmp(argv[i], "--edits") == 0)
+        {
+            edits = 1;
+        }
+        else if (strcmp(argv[i], "--traffic-batched") == 0)
+        {
+            traffic_batched = 1;
+        }
+        else if ((strcmp(argv[i], "--compare-traffic") == 0) &&
+                 (i + 1 < argc))
+        {
+            compare_traffic = strtol(argv[++i], NULL, 0);
+            if (compare_traffic < 0)
+            {
+                printf("Invalid percentage: %d\n", compare_traffic);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--hash") == 0)
+        {
+            print_hash = 1;
+        }
+        else if ((strcmp(argv[i], "--check-golden") == 0) && (i + 1 < argc))
+        {
+            check_golden_path = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--update-golden") == 0) && (i + 1 < argc))
+        {
+            update_golden_path = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--profile-csv") == 0) && (i + 1 < argc))
+        {
+            profile_csv_path = argv[++i];
+#ifndef SIM_PROFILE
+            printf("Built without ENABLE_SIM_PROFILE, can't save %s\n",
+                   profile_csv_path);
+            return 1;
+#endif
+        }
+        else
+        {
+            printf("Invalid argument: %s\n\n", argv[i]);
+            Print_Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int scenario = Find_Scenario(scenario_name);
+    if (scenario < 0)
+    {
+        printf("Scenario not found: %s\n\nAvailable scenarios:\n",
+               scenario_name);
+        List_Scenarios();
+        return 1;
+    }
+
+    if (compare_traffic >= 0)
+    {
+        return Compare_Traffic_Modes(scenario, steps, seed, disasters, edits,
+                                     compare_traffic);
+    }
+
+    golden_state state = {
+        .scenario = scenario,
+        .steps = steps,
+        .seed = seed,
+        .disasters = disasters,
+        .edits = edits,
+        .traffic_batched = traffic_batched,
+    };
+
+    double elapsed = Run_Simulation(scenario, steps, seed, disasters, edits,
+                                    traffic_batched, &state.initial_map);
+
+    printf("Scenario:    %s\n", Room_Scenarios_Get_Name(scenario));
+    printf("Date:        %s\n", DateString());
+    printf("Population:  %u\n", (unsigned int)Simulation_GetTotalPopulation());
+    printf("Funds:       %d\n", (int)MoneyGet());
+    printf("Traffic jam: %d%%\n", Simulation_TrafficGetTrafficJamPercent());
+    printf("Months:      %ld\n", steps);
+    printf("Time:        %.3f s\n", elapsed);
+    if (elapsed > 0.0)
+        printf("Months/s:    %.2f\n", (double)steps / elapsed);
+
+    const bucket_queue *traffic_queue = Simulation_TrafficGetQueue();
+    const queue *power_queue = Simulation_PowerDistributionGetQueue();
+
+    printf("Queue peak:  traffic %d, power %d\n",
+           BucketQueueHighWaterMark(traffic_queue),
+           QueueHighWaterMark(power_queue));
+
+    int ret = 0;
+
+    // An overflow means that part of a flood fill has been dropped, so the
+    // results can't be trusted. The traffic queue can't overflow.
+    if (QueueHasOverflowed(power_queue))
+    {
+        printf("Queue overflow\n");
+        ret = 1;
+    }
+
+    if (print_hash || check_golden_path || update_golden_path)
+    {
+        Golden_HashState(&state);
+
+        if (print_hash)
+            Golden_Print(&state);
+
+        if (update_golden_path != NULL)
+        {
+            if (Golden_Update(update_golden_path, &state) != 0)
+                return 1;
+        }
+
+        if ((check_golden_path != NULL) && (ret == 0))
+            ret = Golden_Check(check_golden_path, &state);
+    }
+
+#ifdef SIM_PROFILE
+    if (profile_csv_path != NULL)
+    {
+        if (Simulation_ProfileDumpCSV(profile_csv_path) != 0)
+        {
+            printf("Can't save %s\n", profile_csv_path);
+            return 1;
+        }
+    }
+#endif
+
+    return ret;
+}
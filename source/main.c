@@ -2,6 +2,10 @@
 //
 // Copyright (c) 2021 Antonio Niño Díaz
 
+#ifdef SIM_PROFILE
+#include <stdlib.h>
+#endif
+
 #include <ugba/ugba.h>
 
 #include "audio.h"
@@ -24,6 +28,7 @@
 #include "room_minimap/room_minimap.h"
 #include "room_save_slots/room_save_slots.h"
 #include "room_scenarios/room_scenarios.h"
+#include "simulation/profile.h"
 
 void Game_Clear_Screen(void)
 {
@@ -323,6 +328,15 @@ static void Game_Room_Handle_Current(void)
 
 // ----------------------------------------------------------------------------
 
+#ifdef SIM_PROFILE
+static void Simulation_Profile_Save(void)
+{
+    Simulation_ProfileDumpCSV("sim_profile.csv");
+}
+#endif
+
+// ----------------------------------------------------------------------------
+
 static int nested_vbl_handler = 0;
 
 IWRAM_CODE ARM_CODE void Master_VBL_Handler(void)
@@ -382,6 +396,11 @@ int main(int argc, char *argv[])
 {
     UGBA_Init(&argc, &argv);
 
+#ifdef SIM_PROFILE
+    // Save the timings of the last simulation steps when the game is closed
+    atexit(Simulation_Profile_Save);
+#endif
+
     IRQ_SetHandler(IRQ_VBLANK, Master_VBL_Handler);
     IRQ_Enable(IRQ_VBLANK);
 
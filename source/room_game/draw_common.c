@@ -3,6 +3,7 @@
 // Copyright (c) 2017-2019, 2021, Antonio Niño Díaz
 
 #include <stdint.h>
+#include <string.h>
 
 #include <ugba/ugba.h>
 
@@ -16,6 +17,147 @@
 #include "room_game/draw_train.h"
 #include "room_game/room_game.h"
 #include "room_game/tileset_info.h"
+#include "simulation/building_registry.h"
+#include "simulation/common.h"
+#include "simulation/pollution.h"
+#include "simulation/power.h"
+#include "simulation/traffic.h"
+#include "simulation/water.h"
+
+// ----------------------------------------------------------------------------
+
+// The simulation doesn't read the map from VRAM. The authoritative copy of the
+// map is this array, which has the same entries as the background map (tile
+// index and flip flags), but in a linear layout instead of the layout of the
+// 4 screenblocks of a 512x512 background. Whenever an entry is modified, its
+// row is flagged as dirty and the span of modified columns of the row is
+// extended to include it. Dirty spans are copied to VRAM during the VBL period
+// by CityMapFlushToVRAM(), with one copy per screenblock.
+
+#if CITY_MAP_HEIGHT > 64
+#error "The dirty row mask can't hold all rows of the map"
+#endif
+
+#if CITY_MAP_WIDTH > 255
+#error "The dirty spans can't hold all columns of the map"
+#endif
+
+EWRAM_BSS static uint16_t city_map[CITY_MAP_WIDTH * CITY_MAP_HEIGHT];
+
+// One bit per row. The main loop sets bits, the VBL handler clears them.
+static volatile uint32_t city_map_dirty_rows[2];
+
+// Dirty columns of each row: first column in the low byte, last column + 1 in
+// the high byte. The span is empty if the end isn't greater than the start. The
+// main loop extends the span before setting the bit of the row, so if the VBL
+// handler interrupts it, the worst case is a row copied twice.
+static volatile uint16_t city_map_dirty_spans[CITY_MAP_HEIGHT];
+
+#define CITY_MAP_ENTRY(x, y)    city_map[(y) * CITY_MAP_WIDTH + (x)]
+
+static inline void CityMapSetDirty(int x, int y)
+{
+    uint16_t span = city_map_dirty_spans[y];
+
+    int start = span & 0xFF;
+    int end = span >> 8;
+
+    if (end <= start)
+    {
+        start = x;
+        end = x + 1;
+    }
+    else
+    {
+        if (x < start)
+            start = x;
+        if (x >= end)
+            end = x + 1;
+    }
+
+    city_map_dirty_spans[y] = start | (end << 8);
+    city_map_dirty_rows[y >> 5] |= 1UL << (y & 31);
+}
+
+static void CityMapSetAllDirty(void)
+{
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+        city_map_dirty_spans[j] = CITY_MAP_WIDTH << 8;
+
+    city_map_dirty_rows[0] = UINT32_MAX;
+    city_map_dirty_rows[1] = UINT32_MAX;
+}
+
+void CityMapLoad(const uint16_t *map)
+{
+    memcpy(city_map, map, sizeof(city_map));
+
+    TypeMatrixRefresh();
+    BuildingRegistryRefresh();
+    PowerGridRefresh();
+    TrafficAnimRefresh();
+    WaterAnimRefresh();
+    PollutionSourcesRefresh();
+
+    CityMapSetAllDirty();
+}
+
+static IWRAM_CODE void CityMapCopySpanToVRAM(int y, int start, int end)
+{
+    void *map = (void *)CITY_MAP_BASE;
+
+    // Each row is split between the left and the right screenblocks
+    while (start < end)
+    {
+        int last = (start | 31) + 1;
+        if (last > end)
+            last = end;
+
+        const uint16_t *src = &CITY_MAP_ENTRY(start, y);
+        uint16_t *dst = get_pointer_sbb(map, start, y);
+        size_t size = (last - start) * sizeof(uint16_t);
+
+#ifdef __GBA__
+        DMA_Copy16(3, src, dst, size);
+#else
+        memcpy(dst, src, size);
+#endif
+
+        start = last;
+    }
+}
+
+IWRAM_CODE void CityMapFlushToVRAM(void)
+{
+    for (int w = 0; w < 2; w++)
+    {
+        uint32_t dirty = city_map_dirty_rows[w];
+        if (dirty == 0)
+            continue;
+
+        city_map_dirty_rows[w] = 0;
+
+        for (int b = 0; dirty != 0; b++, dirty >>= 1)
+        {
+            if ((dirty & 1) == 0)
+                continue;
+
+            int y = w * 32 + b;
+
+            uint16_t span = city_map_dirty_spans[y];
+            city_map_dirty_spans[y] = 0;
+
+            CityMapCopySpanToVRAM(y, span & 0xFF, span >> 8);
+        }
+    }
+}
+
+void CityMapUploadToVRAM(void)
+{
+    CityMapSetAllDirty();
+
+    CityMapFlushToVRAM();
+}
 
 // ----------------------------------------------------------------------------
 
@@ -25,15 +167,13 @@
 // forest, row 64 would have a field. If it was water, the result would be water
 // too.
 
-uint16_t CityMapGetTypeNoBoundCheck(int x, int y)
+IWRAM_CODE uint16_t CityMapGetTypeNoBoundCheck(int x, int y)
 {
-    void *map = (void *)CITY_MAP_BASE;
-    uint16_t tile = MAP_REGULAR_TILE(read_tile_sbb(map, x, y));
-    const city_tile_info *tile_info = City_Tileset_Entry_Info(tile);
-    return tile_info->element_type;
+    const uint8_t *type_matrix = TypeMatrixGet();
+    return type_matrix[y * CITY_MAP_WIDTH + x];
 }
 
-uint16_t CityMapGetType(int x, int y)
+IWRAM_CODE uint16_t CityMapGetType(int x, int y)
 {
     int fix = 0;
 
@@ -66,16 +206,13 @@ uint16_t CityMapGetType(int x, int y)
         return TYPE_FIELD;
     }
 
-    void *map = (void *)CITY_MAP_BASE;
-    uint16_t tile = MAP_REGULAR_TILE(read_tile_sbb(map, x, y));
-    const city_tile_info *tile_info = City_Tileset_Entry_Info(tile);
-    return tile_info->element_type;
+    const uint8_t *type_matrix = TypeMatrixGet();
+    return type_matrix[y * CITY_MAP_WIDTH + x];
 }
 
-uint16_t CityMapGetTile(int x, int y)
+IWRAM_CODE uint16_t CityMapGetTile(int x, int y)
 {
-    void *map = (void *)CITY_MAP_BASE;
-    return MAP_REGULAR_TILE(read_tile_sbb(map, x, y));
+    return MAP_REGULAR_TILE(CITY_MAP_ENTRY(x, y));
 }
 
 uint16_t CityMapGetTileClamped(int x, int y)
@@ -90,16 +227,15 @@ uint16_t CityMapGetTileClamped(int x, int y)
     else if (y > (CITY_MAP_HEIGHT - 1))
         y = CITY_MAP_HEIGHT - 1;
 
-    void *map = (void *)CITY_MAP_BASE;
-    return MAP_REGULAR_TILE(read_tile_sbb(map, x, y));
+    return MAP_REGULAR_TILE(CITY_MAP_ENTRY(x, y));
 }
 
-void CityMapGetTypeAndTileUnsafe(int x, int y, uint16_t *tile, uint16_t *type)
+IWRAM_CODE void CityMapGetTypeAndTileUnsafe(int x, int y,
+                                            uint16_t *tile, uint16_t *type)
 {
-    void *map = (void *)CITY_MAP_BASE;
-    *tile = MAP_REGULAR_TILE(read_tile_sbb(map, x, y));
-    const city_tile_info *tile_info = City_Tileset_Entry_Info(*tile);
-    *type = tile_info->element_type;
+    const uint8_t *type_matrix = TypeMatrixGet();
+    *tile = MAP_REGULAR_TILE(CITY_MAP_ENTRY(x, y));
+    *type = type_matrix[y * CITY_MAP_WIDTH + x];
 }
 
 void CityMapGetTypeAndTile(int x, int y, uint16_t *tile, uint16_t *type)
@@ -151,33 +287,49 @@ void CityMapGetTypeAndTile(int x, int y, uint16_t *tile, uint16_t *type)
 
 void CityMapDrawTile(uint16_t tile, int x, int y)
 {
-    void *map = (void *)CITY_MAP_BASE;
-    uint16_t vram_info = City_Tileset_VRAM_Info(tile);
-    write_tile_sbb(vram_info, map, x, y);
+    PowerGridUpdate(x, y, tile);
+
+    CITY_MAP_ENTRY(x, y) = City_Tileset_VRAM_Info(tile);
+    CityMapSetDirty(x, y);
+
+    TypeMatrixUpdate(x, y, tile);
+    BuildingRegistryUpdate(x, y, tile);
+    TrafficAnimUpdate(x, y, tile);
+    WaterAnimUpdate(x, y, tile);
+    PollutionSourcesUpdate(x, y, tile);
 }
 
 void CityMapDrawTilePreserveFlip(uint16_t tile, int x, int y)
 {
-    void *map = (void *)CITY_MAP_BASE;
-    uint16_t *ptr = get_pointer_sbb(map, x, y);
+    PowerGridUpdate(x, y, tile);
+
+    uint16_t *ptr = &CITY_MAP_ENTRY(x, y);
 
     uint16_t vram_info = City_Tileset_VRAM_Info(tile);
 
     uint16_t mask = MAP_REGULAR_HFLIP | MAP_REGULAR_VFLIP;
 
     *ptr = (*ptr & mask) | vram_info;
+
+    CityMapSetDirty(x, y);
+
+    TypeMatrixUpdate(x, y, tile);
+    BuildingRegistryUpdate(x, y, tile);
+    TrafficAnimUpdate(x, y, tile);
+    WaterAnimUpdate(x, y, tile);
+    PollutionSourcesUpdate(x, y, tile);
 }
 
 void CityMapToggleHFlip(int x, int y)
 {
-    void *map = (void *)CITY_MAP_BASE;
-    toggle_hflip_tile_sbb(map, x, y);
+    CITY_MAP_ENTRY(x, y) ^= MAP_REGULAR_HFLIP;
+    CityMapSetDirty(x, y);
 }
 
 void CityMapToggleVFlip(int x, int y)
 {
-    void *map = (void *)CITY_MAP_BASE;
-    toggle_vflip_tile_sbb(map, x, y);
+    CITY_MAP_ENTRY(x, y) ^= MAP_REGULAR_VFLIP;
+    CityMapSetDirty(x, y);
 }
 
 // Checks if a bridge of a certain type can be built. For that to be possible,
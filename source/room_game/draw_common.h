@@ -7,6 +7,18 @@
 
 #include <stdint.h>
 
+// Replace the whole city map. The source must be an array of
+// CITY_MAP_WIDTH * CITY_MAP_HEIGHT background map entries in row-major order.
+void CityMapLoad(const uint16_t *map);
+
+// Copy the entries of the map modified since the last call to VRAM. This must
+// be called during the VBL period.
+void CityMapFlushToVRAM(void);
+
+// Copy the whole map to VRAM. This must be called when the city background has
+// been setup after VRAM has been used by other rooms.
+void CityMapUploadToVRAM(void);
+
 uint16_t CityMapGetType(int x, int y);
 uint16_t CityMapGetTypeNoBoundCheck(int x, int y);
 uint16_t CityMapGetTile(int x, int y);
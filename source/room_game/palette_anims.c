@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021, Antonio Niño Díaz
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ugba/ugba.h>
+
+#include "room_game/palette_anims.h"
+#include "room_game/room_game.h"
+#include "room_game/tileset_info.h"
+
+// The palette of the city uses the first 160 colors (it is converted with
+// "--colors 160" in maps/city/convert.sh). The text of the status bar uses
+// palette 14, so the entries between them are free.
+#define PALETTE_ANIMS_FIRST_COLOR   160
+#define PALETTE_ANIMS_MAX_COLORS    32
+
+#define TILE_SIZE_8BPP              (8 * 8)
+
+// Colors of the animated palette entries in each frame of the animation
+static uint16_t anim_colors[2][PALETTE_ANIMS_MAX_COLORS];
+static int anim_num_colors;
+static int anim_frame;
+
+// Palette indices of the original colors of each animated palette entry
+static uint8_t anim_source[PALETTE_ANIMS_MAX_COLORS][2];
+
+typedef enum {
+    ANIM_FLIP_V, // Animated with vertical flips
+    ANIM_FLIP_H, // Animated with horizontal flips
+    ANIM_SWAP,   // Animated by swapping it with another tile
+} anim_kind;
+
+typedef struct {
+    uint16_t tile;
+    uint16_t other; // Only used by ANIM_SWAP
+    anim_kind kind;
+} anim_tile_info;
+
+static const anim_tile_info anim_tiles[] = {
+    { T_ROAD_TB_1, 0, ANIM_FLIP_V },
+    { T_ROAD_TB_2, 0, ANIM_FLIP_V },
+    { T_ROAD_TB_3, 0, ANIM_FLIP_V },
+    { T_ROAD_LR_1, 0, ANIM_FLIP_H },
+    { T_ROAD_LR_2, 0, ANIM_FLIP_H },
+    { T_ROAD_LR_3, 0, ANIM_FLIP_H },
+    // Both water tiles are animated, but in opposite frames
+    { T_WATER, T_WATER_EXTRA, ANIM_SWAP },
+    { T_WATER_EXTRA, T_WATER, ANIM_SWAP },
+};
+
+#define NUM_ANIM_TILES  (sizeof(anim_tiles) / sizeof(anim_tiles[0]))
+
+// Returns the palette entry that alternates between the colors with indices a
+// and b of the palette, or -1 if there are no free entries left.
+static int PaletteAnimsGetColor(int a, int b)
+{
+    for (int i = 0; i < anim_num_colors; i++)
+    {
+        if ((anim_source[i][0] == a) && (anim_source[i][1] == b))
+            return PALETTE_ANIMS_FIRST_COLOR + i;
+    }
+
+    if (anim_num_colors == PALETTE_ANIMS_MAX_COLORS)
+        return -1;
+
+    int i = anim_num_colors++;
+
+    anim_source[i][0] = a;
+    anim_source[i][1] = b;
+
+    return PALETTE_ANIMS_FIRST_COLOR + i;
+}
+
+// Tiles that use the animated palette entries
+static uint8_t patched[NUM_ANIM_TILES][TILE_SIZE_8BPP];
+
+// Returns 0 on success, -1 if the tiles can't be animated with palettes
+static int PaletteAnimsBuildTiles(const uint8_t *src_tiles, size_t num_tiles,
+                                  size_t num_colors)
+{
+    anim_num_colors = 0;
+
+    for (size_t t = 0; t < NUM_ANIM_TILES; t++)
+    {
+        const anim_tile_info *info = &anim_tiles[t];
+
+        size_t index = MAP_REGULAR_TILE(City_Tileset_VRAM_Info(info->tile));
+        size_t other_index =
+                MAP_REGULAR_TILE(City_Tileset_VRAM_Info(info->other));
+
+        if ((index >= num_tiles) || (other_index >= num_tiles))
+            return -1;
+
+        const uint8_t *src = &src_tiles[index * TILE_SIZE_8BPP];
+        const uint8_t *other = &src_tiles[other_index * TILE_SIZE_8BPP];
+
+        for (int y = 0; y < 8; y++)
+        {
+            for (int x = 0; x < 8; x++)
+            {
+                int a = src[y * 8 + x];
+                int b;
+
+                if (info->kind == ANIM_FLIP_V)
+                    b = src[(7 - y) * 8 + x];
+                else if (info->kind == ANIM_FLIP_H)
+                    b = src[y * 8 + (7 - x)];
+                else
+                    b = other[y * 8 + x];
+
+                if (a == b)
+                {
+                    patched[t][y * 8 + x] = a;
+                    continue;
+                }
+
+                if ((a >= (int)num_colors) || (b >= (int)num_colors))
+                    return -1;
+
+                int color = PaletteAnimsGetColor(a, b);
+                if (color < 0)
+                    return -1;
+
+                patched[t][y * 8 + x] = color;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int PaletteAnimsLoad(const void *tiles, size_t tiles_size,
+                     const void *palette, size_t palette_size)
+{
+    const uint16_t *src_palette = palette;
+
+    size_t num_tiles = tiles_size / TILE_SIZE_8BPP;
+    size_t num_colors = palette_size / sizeof(uint16_t);
+
+    // The animated entries would overwrite colors used by the city
+    if (num_colors > PALETTE_ANIMS_FIRST_COLOR)
+        return -1;
+
+    // Build all tiles before modifying VRAM in case there aren't enough free
+    // palette entries.
+    if (PaletteAnimsBuildTiles(tiles, num_tiles, num_colors) != 0)
+    {
+        anim_num_colors = 0;
+        return -1;
+    }
+
+    anim_frame = 0;
+
+    for (int i = 0; i < anim_num_colors; i++)
+    {
+        anim_colors[0][i] = src_palette[anim_source[i][0]];
+        anim_colors[1][i] = src_palette[anim_source[i][1]];
+
+        MEM_PALETTE_BG[PALETTE_ANIMS_FIRST_COLOR + i] = anim_colors[0][i];
+    }
+
+    for (size_t t = 0; t < NUM_ANIM_TILES; t++)
+    {
+        uint16_t index = City_Tileset_VRAM_Info(anim_tiles[t].tile);
+        uintptr_t addr = CITY_TILES_BASE
+                       + MAP_REGULAR_TILE(index) * TILE_SIZE_8BPP;
+
+        SWI_CpuSet_Copy16(&patched[t][0], (void *)addr, TILE_SIZE_8BPP);
+    }
+
+    return 0;
+}
+
+IWRAM_CODE void PaletteAnimsVBLHandle(void)
+{
+    anim_frame ^= 1;
+
+    const uint16_t *colors = &anim_colors[anim_frame][0];
+
+    for (int i = 0; i < anim_num_colors; i++)
+        MEM_PALETTE_BG[PALETTE_ANIMS_FIRST_COLOR + i] = colors[i];
+}
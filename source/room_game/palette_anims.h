@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021, Antonio Niño Díaz
+
+#ifndef ROOM_GAME_PALETTE_ANIMS_H__
+#define ROOM_GAME_PALETTE_ANIMS_H__
+
+#include <stddef.h>
+
+// In this mode the pixels of the tiles with traffic and water animations that
+// change between animation frames use dedicated palette entries. The animation
+// is done by swapping the colors of those entries, so it doesn't need to
+// modify the map, and its cost doesn't depend on the contents of the map.
+
+// Patch the tiles of the city in VRAM so that they use the animated palette
+// entries. It needs the tileset and palette that have been loaded to VRAM.
+// Returns 0 on success. If the animated tiles need more colors than available,
+// or if the palette uses the entries reserved for the animations, VRAM isn't
+// modified and it returns -1.
+int PaletteAnimsLoad(const void *tiles, size_t tiles_size,
+                     const void *palette, size_t palette_size);
+
+// Swap the colors of the animated palette entries. Call it during VBL.
+void PaletteAnimsVBLHandle(void);
+
+#endif // ROOM_GAME_PALETTE_ANIMS_H__
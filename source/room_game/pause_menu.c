@@ -63,6 +63,7 @@ static menu_entry_info menu_entry[] = {
     [DISASTERS_MELTDOWN]            = { 11, 9, "Meltdown" },
 
     [OPTIONS_ANIMATIONS_ENABLE]     = { 11, 6, "Enable" },
+    [OPTIONS_ANIMATIONS_PALETTE]    = { 11, 7, "Tiles" },
     [OPTIONS_MUSIC_ENABLE]          = { 11, 10, "Enable" },
     [OPTIONS_GRAPHICS_NEW]          = { 11, 14, "New" },
 };
@@ -162,6 +163,14 @@ static void PauseMenuDrawOptions(void)
     else
         StatusBarPrint(x, y, "Enable ");
 
+    x = menu_entry[OPTIONS_ANIMATIONS_PALETTE].x;
+    y = menu_entry[OPTIONS_ANIMATIONS_PALETTE].y + (32 - 30);
+
+    if (Room_Game_ArePaletteAnimationsEnabled())
+        StatusBarPrint(x, y, "Palette");
+    else
+        StatusBarPrint(x, y, "Tiles  ");
+
     x = menu_entry[OPTIONS_MUSIC_ENABLE].x;
     y = menu_entry[OPTIONS_MUSIC_ENABLE].y + (32 - 30);
 
@@ -377,6 +386,8 @@ static pause_menu_options PauseMenuHandleInputOptions(void)
     {
         if (selected_option == OPTIONS_ANIMATIONS_ENABLE)
             return OPTIONS_ANIMATIONS_ENABLE;
+        else if (selected_option == OPTIONS_ANIMATIONS_PALETTE)
+            return OPTIONS_ANIMATIONS_PALETTE;
         else if (selected_option == OPTIONS_MUSIC_ENABLE)
             return OPTIONS_MUSIC_ENABLE;
         else if (selected_option == OPTIONS_GRAPHICS_NEW)
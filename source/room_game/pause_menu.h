@@ -42,6 +42,7 @@ typedef enum {
     OPTIONS_MENU_MIN,
 
     OPTIONS_ANIMATIONS_ENABLE = OPTIONS_MENU_MIN,
+    OPTIONS_ANIMATIONS_PALETTE,
     OPTIONS_MUSIC_ENABLE,
     OPTIONS_GRAPHICS_NEW,
 
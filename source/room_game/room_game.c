@@ -13,7 +13,6 @@
 #include "jukebox.h"
 #include "main.h"
 #include "money.h"
-#include "map_utils.h"
 #include "random.h"
 #include "save.h"
 #include "sfx.h"
@@ -24,6 +23,7 @@
 #include "room_game/draw_building.h"
 #include "room_game/draw_common.h"
 #include "room_game/notification_box.h"
+#include "room_game/palette_anims.h"
 #include "room_game/pause_menu.h"
 #include "room_game/room_game.h"
 #include "room_game/text_messages.h"
@@ -58,6 +58,11 @@ static int graphics_are_new = 1;
 static int simulation_enabled = 1;
 static int animations_enabled = 1;
 
+// Traffic and water are animated with palettes if requested and if the tileset
+// allows it. If not, they are animated by modifying the map.
+static int palette_animations_requested = 0;
+static int palette_animations_active = 0;
+
 // Frames left for a simulation step
 static int frames_left_to_step = 0;
 #define MIN_FRAMES_PER_DATE_STEP    60
@@ -107,6 +112,18 @@ int Room_Game_AreAnimationsEnabled(void)
     return 0;
 }
 
+void Room_Game_SetPaletteAnimationsEnabled(int value)
+{
+    palette_animations_requested = value;
+}
+
+int Room_Game_ArePaletteAnimationsEnabled(void)
+{
+    if (palette_animations_requested)
+        return 1;
+    return 0;
+}
+
 static void GameAnimateMapVBLFastHandle(void)
 {
     if (animations_enabled == 0)
@@ -124,6 +141,9 @@ static void GameAnimateMapVBLFastHandle(void)
 
         animation_countdown = 0;
 
+        if (palette_animations_active)
+            PaletteAnimsVBLHandle();
+
         animation_has_to_update_map = 1;
 
         return;
@@ -151,6 +171,9 @@ static void GameAnimateMapVBLFastHandle(void)
 
         animation_countdown = 0;
 
+        if (palette_animations_active)
+            PaletteAnimsVBLHandle();
+
         animation_has_to_update_map = 1;
 
         return;
@@ -169,7 +192,8 @@ static void GameAnimateMap(void)
         if (animation_has_to_update_map)
         {
             Simulation_FireAnimate();
-            Simulation_WaterAnimate();
+            if (palette_animations_active == 0)
+                Simulation_WaterAnimate();
 
             animation_has_to_update_map = 0;
         }
@@ -188,8 +212,11 @@ static void GameAnimateMap(void)
 
         if (animation_has_to_update_map)
         {
-            Simulation_TrafficAnimate();
-            Simulation_WaterAnimate();
+            if (palette_animations_active == 0)
+            {
+                Simulation_TrafficAnimate();
+                Simulation_WaterAnimate();
+            }
 
             animation_has_to_update_map = 0;
         }
@@ -235,8 +262,7 @@ static void Load_City_Data(const void *map, int scx, int scy)
     if (map)
     {
         // Load the map
-        copy_map_to_sbb(map, (void *)CITY_MAP_BASE,
-                        CITY_MAP_HEIGHT, CITY_MAP_WIDTH);
+        CityMapLoad(map);
     }
 
     mapx = scx * 8;
@@ -274,6 +300,19 @@ void Room_Game_Load_City_Graphics(void)
         // Load the tiles
         SWI_CpuSet_Copy16(city_map_tiles_bin, (void *)CITY_TILES_BASE,
                           city_map_tiles_bin_size);
+
+        if (palette_animations_requested)
+        {
+            int ret = PaletteAnimsLoad(city_map_tiles_bin,
+                                       city_map_tiles_bin_size,
+                                       city_map_palette_bin,
+                                       city_map_palette_bin_size);
+            palette_animations_active = (ret == 0);
+        }
+        else
+        {
+            palette_animations_active = 0;
+        }
     }
     else
     {
@@ -285,6 +324,19 @@ void Room_Game_Load_City_Graphics(void)
         // Load the tiles
         SWI_CpuSet_Copy16(city_map_tiles_gbc_bin, (void *)CITY_TILES_BASE,
                           city_map_tiles_gbc_bin_size);
+
+        if (palette_animations_requested)
+        {
+            int ret = PaletteAnimsLoad(city_map_tiles_gbc_bin,
+                                       city_map_tiles_gbc_bin_size,
+                                       city_map_palette_gbc_bin,
+                                       city_map_palette_gbc_bin_size);
+            palette_animations_active = (ret == 0);
+        }
+        else
+        {
+            palette_animations_active = 0;
+        }
     }
 
     // Setup background
@@ -714,6 +766,7 @@ void Room_Game_Load(void)
     // ---------------
 
     Room_Game_Load_City_Graphics();
+    CityMapUploadToVRAM();
 
     BG_RegularScrollSet(2, mapx, mapy);
 
@@ -851,6 +904,8 @@ void Room_Game_Handle(void)
 
 void Room_Game_FastVBLHandler(void)
 {
+    CityMapFlushToVRAM();
+
     GameAnimateMapVBLFastHandle();
 
     switch (current_mode)
@@ -1150,6 +1205,11 @@ void Room_Game_SlowVBLHandler(void)
                     animations_enabled ^= 1;
                     PauseMenuDraw();
                     break;
+                case OPTIONS_ANIMATIONS_PALETTE:
+                    palette_animations_requested ^= 1;
+                    Room_Game_Load_City_Graphics();
+                    PauseMenuDraw();
+                    break;
                 case OPTIONS_MUSIC_ENABLE:
                     Audio_Enable_Set(Audio_Enable_Get() ^ 1);
                     PauseMenuDraw();
@@ -1331,8 +1391,7 @@ void Room_Game_City_Save(int slot_index)
     {
         for (int i = 0; i < CITY_MAP_WIDTH; i++)
         {
-            void *map = (void *)CITY_MAP_BASE;
-            uint16_t tile = read_tile_sbb(map, i, j);
+            uint16_t tile = CityMapGetTile(i, j);
             city->map_lsb[j * CITY_MAP_WIDTH + i] = tile & 0xFF;
 
             uint16_t msb;
@@ -1355,7 +1414,10 @@ void Room_Game_Settings_Load(void)
     volatile save_data *sav = Save_Data_Get();
 
     Simulation_DisastersSetEnabled(sav->disasters_enabled);
-    Room_Game_SetAnimationsEnabled(sav->animations_enabled);
+    Room_Game_SetAnimationsEnabled(sav->animations_enabled &
+                                   SAVE_ANIMATIONS_ENABLED);
+    Room_Game_SetPaletteAnimationsEnabled(sav->animations_enabled &
+                                          SAVE_ANIMATIONS_PALETTE);
     Audio_Enable_Set(sav->music_enabled);
     Room_Game_Graphics_New_Set(sav->new_graphics);
 
@@ -1371,7 +1433,12 @@ void Room_Game_Settings_Save(void)
     volatile save_data *sav = Save_Data_Get();
 
     sav->disasters_enabled = Simulation_AreDisastersEnabled();
-    sav->animations_enabled = Room_Game_AreAnimationsEnabled();
+    uint8_t animations = 0;
+    if (Room_Game_AreAnimationsEnabled())
+        animations |= SAVE_ANIMATIONS_ENABLED;
+    if (Room_Game_ArePaletteAnimationsEnabled())
+        animations |= SAVE_ANIMATIONS_PALETTE;
+    sav->animations_enabled = animations;
     sav->music_enabled = Audio_Enable_Get();
     sav->new_graphics = Room_Game_Graphics_New_Get();
 
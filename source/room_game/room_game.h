@@ -120,6 +120,8 @@ int Room_Game_IsSimulationEnabled(void);
 
 void Room_Game_SetAnimationsEnabled(int value);
 int Room_Game_AreAnimationsEnabled(void);
+void Room_Game_SetPaletteAnimationsEnabled(int value);
+int Room_Game_ArePaletteAnimationsEnabled(void);
 
 void Room_Game_Set_Initial_Load_State(void);
 
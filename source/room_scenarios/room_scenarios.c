@@ -74,6 +74,8 @@ typedef enum {
     SCENARIO_MAX = SCENARIO_FUTURA,
 
     SCENARIO_TEST_MAP,
+
+    SCENARIO_NUMBER
 } scenario_enum;
 
 static const scenario_info scenarios[] = {
@@ -362,6 +364,44 @@ static void Draw_User_Interface(void)
     Room_Scenarios_Print(1, 13, DateString());
 }
 
+int Room_Scenarios_Get_Number(void)
+{
+    return SCENARIO_NUMBER;
+}
+
+const char *Room_Scenarios_Get_Name(int index)
+{
+    if ((index < 0) || (index >= SCENARIO_NUMBER))
+        return NULL;
+
+    return scenarios[index].name;
+}
+
+void Room_Scenarios_Setup_City(int index)
+{
+    UGBA_Assert((index >= 0) && (index < SCENARIO_NUMBER));
+
+    const scenario_info *s = &scenarios[index];
+
+    // Setup initial game state
+    Room_Game_Load_City(s->map, s->name, s->start_scroll_x, s->start_scroll_y);
+    Room_Game_Set_City_Date(s->start_month, s->start_year);
+    Simulation_SetCityClass(s->city_type);
+    Room_Game_Set_City_Economy(s->start_funds, s->tax_percentage,
+                               s->payments_left, s->amount_per_payment);
+    Technology_SetLevel(s->technology_level);
+    for (int i = 0; i < MAX_PERMANENT_MSGS_TO_DISABLE; i++)
+    {
+        int id = s->permanent_msgs_to_disable[i];
+        if (id != 0)
+            PersistentMessageFlagAsShown(id);
+    }
+    Simulation_NegativeBudgetCountSet(0);
+    Simulation_GraphsResetAll();
+    Room_Game_Set_Initial_Load_State();
+    rand_slow_set_seed(rand_fast()); // Generate a new seed
+}
+
 void Room_Scenarios_Load(void)
 {
     // Load frame map
@@ -481,25 +521,7 @@ void Room_Scenarios_Handle(void)
 
     if (keys_pressed & KEY_A)
     {
-        const scenario_info *s = &scenarios[selected_scenario];
-
-        // Setup initial game state
-        Room_Game_Load_City(s->map, s->name, s->start_scroll_x, s->start_scroll_y);
-        Room_Game_Set_City_Date(s->start_month, s->start_year);
-        Simulation_SetCityClass(s->city_type);
-        Room_Game_Set_City_Economy(s->start_funds, s->tax_percentage,
-                                   s->payments_left, s->amount_per_payment);
-        Technology_SetLevel(s->technology_level);
-        for (int i = 0; i < MAX_PERMANENT_MSGS_TO_DISABLE; i++)
-        {
-            int id = s->permanent_msgs_to_disable[i];
-            if (id != 0)
-                PersistentMessageFlagAsShown(id);
-        }
-        Simulation_NegativeBudgetCountSet(0);
-        Simulation_GraphsResetAll();
-        Room_Game_Set_Initial_Load_State();
-        rand_slow_set_seed(rand_fast()); // Generate a new seed
+        Room_Scenarios_Setup_City(selected_scenario);
         Game_Room_Prepare_Switch(ROOM_GAME);
         return;
     }
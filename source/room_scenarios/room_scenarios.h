@@ -10,4 +10,11 @@ void Room_Scenarios_Unload(void);
 
 void Room_Scenarios_Handle(void);
 
+// Number of scenarios, including the test map
+int Room_Scenarios_Get_Number(void);
+// Returns NULL if the index is out of bounds
+const char *Room_Scenarios_Get_Name(int index);
+// Setup the game state (map, date, economy...) of the specified scenario
+void Room_Scenarios_Setup_City(int index);
+
 #endif // ROOM_SCENARIOS_ROOM_SCENARIOS_H__
@@ -106,7 +106,8 @@ EWRAM_CODE void Save_Data_Reset(void)
     sav->disasters_enabled = 1;
 
     Room_Game_SetAnimationsEnabled(1);
-    sav->animations_enabled = 1;
+    Room_Game_SetPaletteAnimationsEnabled(0);
+    sav->animations_enabled = SAVE_ANIMATIONS_ENABLED;
 
     Audio_Enable_Set(1);
     sav->music_enabled = 1;
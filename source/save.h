@@ -16,6 +16,10 @@
 #define MAGIC_STRING        "UCY0"
 #define MAGIC_STRING_LEN    4
 
+// Flags of save_data.animations_enabled. Old saves only have the first one.
+#define SAVE_ANIMATIONS_ENABLED     (1 << 0)
+#define SAVE_ANIMATIONS_PALETTE     (1 << 1)
+
 typedef struct {
     uint8_t     name[CITY_MAX_NAME_LENGTH];
 
@@ -63,7 +67,7 @@ typedef struct {
     uint8_t     rand_fast_seed[4];
 
     uint8_t     disasters_enabled;
-    uint8_t     animations_enabled;
+    uint8_t     animations_enabled; // SAVE_ANIMATIONS_xxx flags
     uint8_t     music_enabled;
     uint8_t     new_graphics;
 
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021, Antonio Niño Díaz
+
+#include <stdint.h>
+
+#include <ugba/ugba.h>
+
+#include "simulation/bucket_queue.h"
+
+IWRAM_CODE static void BucketQueueClearBucket(bucket_queue *q, int key)
+{
+    int head = q->num_elements + key;
+
+    q->node[head].next = head;
+    q->node[head].prev = head;
+}
+
+IWRAM_CODE static void BucketQueueUnlink(bucket_queue *q, int element)
+{
+    bucket_queue_node *n = &q->node[element];
+
+    q->node[n->prev].next = n->next;
+    q->node[n->next].prev = n->prev;
+
+    n->next = BUCKET_QUEUE_NONE;
+}
+
+IWRAM_CODE void BucketQueueInit(bucket_queue *q)
+{
+    if (!q->ready)
+    {
+        for (int i = 0; i < q->num_elements; i++)
+            q->node[i].next = BUCKET_QUEUE_NONE;
+
+        for (int i = 0; i < q->num_buckets; i++)
+            BucketQueueClearBucket(q, i);
+
+        q->ready = 1;
+    }
+    else
+    {
+        // Only clear the buckets that may have been used since the last time,
+        // and flag the elements left in them as not being in the queue.
+
+        for (int i = q->current; i <= q->last; i++)
+        {
+            int head = q->num_elements + i;
+            int element = q->node[head].next;
+
+            while (element != head)
+            {
+                int next = q->node[element].next;
+                q->node[element].next = BUCKET_QUEUE_NONE;
+                element = next;
+            }
+
+            BucketQueueClearBucket(q, i);
+        }
+    }
+
+    q->reading = 0;
+    q->current = q->num_buckets - 1;
+    q->last = 0;
+    q->count = 0;
+}
+
+IWRAM_CODE void BucketQueueAdd(bucket_queue *q, int key, uint16_t element)
+{
+    UGBA_Assert((key >= 0) && (key < q->num_buckets));
+    UGBA_Assert(element < q->num_elements);
+
+    bucket_queue_node *n = &q->node[element];
+
+    if (n->next != BUCKET_QUEUE_NONE)
+    {
+        BucketQueueUnlink(q, element);
+        q->count--;
+    }
+
+    // Add it to the end of the list of the bucket
+
+    int head = q->num_elements + key;
+    int tail = q->node[head].prev;
+
+    n->prev = tail;
+    n->next = head;
+    q->node[tail].next = element;
+    q->node[head].prev = element;
+
+    // Before the first element is read the queue isn't monotone yet, the
+    // first key to read is the lowest one that has been added.
+    if (key < q->current)
+    {
+        UGBA_Assert(!q->reading);
+        q->current = key;
+    }
+
+    if (key > q->last)
+        q->last = key;
+
+    q->count++;
+    if (q->count > q->high_water)
+        q->high_water = q->count;
+}
+
+IWRAM_CODE uint16_t BucketQueueGet(bucket_queue *q, int *key)
+{
+    UGBA_Assert(q->count > 0);
+
+    int head = q->num_elements + q->current;
+
+    while (q->node[head].next == head)
+    {
+        q->current++;
+        head++;
+    }
+
+    int element = q->node[head].next;
+
+    BucketQueueUnlink(q, element);
+
+    q->reading = 1;
+    q->count--;
+
+    *key = q->current;
+
+    return element;
+}
+
+// Returns 1 if empty
+IWRAM_CODE int BucketQueueIsEmpty(const bucket_queue *q)
+{
+    if (q->count == 0)
+        return 1;
+
+    return 0;
+}
+
+int BucketQueueHighWaterMark(const bucket_queue *q)
+{
+    return q->high_water;
+}
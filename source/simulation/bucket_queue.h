@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021, Antonio Niño Díaz
+
+#ifndef SIMULATION_BUCKET_QUEUE_H__
+#define SIMULATION_BUCKET_QUEUE_H__
+
+#include <stdint.h>
+
+// Monotone priority queue with one bucket per key (Dial's algorithm). Elements
+// are returned in increasing order of key, and in FIFO order if they have the
+// same key. It is only valid to add elements with a key that is greater or
+// equal than the key of the last element returned by BucketQueueGet().
+//
+// Elements are numbers between 0 and the number of elements of the queue minus
+// one, and each element can only be in the queue once. Adding an element that
+// is already in the queue moves it to the end of the bucket of the new key, so
+// the queue can never hold more elements than that.
+
+#define BUCKET_QUEUE_NONE   0xFFFF
+
+// Each bucket is a circular doubly linked list. The first nodes of the array
+// belong to the elements, and they are followed by one node per bucket that
+// is used as the head of the list of the bucket.
+typedef struct {
+    uint16_t next;      // BUCKET_QUEUE_NONE if the element isn't in the queue
+    uint16_t prev;
+} bucket_queue_node;
+
+typedef struct {
+    bucket_queue_node *node;
+    int num_elements;
+    int num_buckets;    // Number of buckets (the max key is num_buckets - 1)
+    int ready;          // 1 if the nodes have been initialized
+    int reading;        // 1 if any element has been read since the last init
+    int current;        // Key of the bucket being read
+    int last;           // Highest key used since the last init
+    int count;          // Number of elements in the queue
+    int high_water;     // Max number of elements in the queue at any point
+} bucket_queue;
+
+// Initializer of a queue that uses the specified array as nodes:
+//
+//     static bucket_queue_node nodes[NUM_ELEMENTS + MAX_KEY + 1];
+//     static bucket_queue q = BUCKET_QUEUE_INITIALIZER(nodes, MAX_KEY + 1);
+#define BUCKET_QUEUE_INITIALIZER(nodes, buckets)                            \
+    {                                                                       \
+        .node = (nodes),                                                    \
+        .num_elements = sizeof(nodes) / sizeof((nodes)[0]) - (buckets),     \
+        .num_buckets = (buckets),                                           \
+    }
+
+// Remove all elements. The statistics aren't cleared.
+void BucketQueueInit(bucket_queue *q);
+
+// If the element is already in the queue it is moved to the specified key.
+void BucketQueueAdd(bucket_queue *q, int key, uint16_t element);
+
+// Returns the element, and its key in `key`.
+uint16_t BucketQueueGet(bucket_queue *q, int *key);
+
+int BucketQueueIsEmpty(const bucket_queue *q);
+
+int BucketQueueHighWaterMark(const bucket_queue *q);
+
+#endif // SIMULATION_BUCKET_QUEUE_H__
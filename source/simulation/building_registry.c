@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021, Antonio Niño Díaz
+
+#include <stdint.h>
+
+#include <ugba/ugba.h>
+
+#include "room_game/building_info.h"
+#include "room_game/draw_common.h"
+#include "room_game/room_game.h"
+#include "room_game/tileset_info.h"
+#include "simulation/building_registry.h"
+
+#if CITY_MAP_WIDTH != 64
+#error "Each row of the origins bitboard must fit in a 64-bit word"
+#endif
+
+// Bitboard with one bit per tile. A bit is set if that tile is the origin of a
+// building. It is always up to date.
+EWRAM_BSS static uint64_t building_origins[CITY_MAP_HEIGHT];
+
+static int BuildingRegistryIsOrigin(uint16_t tile)
+{
+    const city_tile_info *info = City_Tileset_Entry_Info(tile);
+    uint16_t type = info->element_type & TYPE_MASK;
+
+    if ((type == TYPE_FIELD) || (type == TYPE_FOREST) ||
+        (type == TYPE_WATER) || (type == TYPE_DOCK))
+        return 0;
+
+    if ((info->base_x_delta != 0) || (info->base_y_delta != 0))
+        return 0;
+
+    return 1;
+}
+
+void BuildingRegistryRefresh(void)
+{
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        uint64_t row = 0;
+
+        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        {
+            if (BuildingRegistryIsOrigin(CityMapGetTile(i, j)))
+                row |= (uint64_t)1 << i;
+        }
+
+        building_origins[j] = row;
+    }
+}
+
+void BuildingRegistryUpdate(int x, int y, uint16_t tile)
+{
+    uint64_t bit = (uint64_t)1 << x;
+
+    int was_origin = (building_origins[y] & bit) != 0;
+    int is_origin = BuildingRegistryIsOrigin(tile);
+
+    if (was_origin == is_origin)
+        return;
+
+    if (is_origin)
+        building_origins[y] |= bit;
+    else
+        building_origins[y] &= ~bit;
+}
+
+void BuildingRegistryIteratorStart(building_registry_iterator *it)
+{
+    it->y = 0;
+    it->row = building_origins[0];
+}
+
+int BuildingRegistryIteratorNext(building_registry_iterator *it,
+                                 building_registry_entry *e)
+{
+    while (it->row == 0)
+    {
+        it->y++;
+        if (it->y == CITY_MAP_HEIGHT)
+            return 0;
+
+        it->row = building_origins[it->y];
+    }
+
+    int i = __builtin_ctzll(it->row);
+    it->row &= it->row - 1;
+
+    uint16_t tile, type;
+    CityMapGetTypeAndTileUnsafe(i, it->y, &tile, &type);
+
+    e->x = i;
+    e->y = it->y;
+    e->tile = tile;
+    e->type = type;
+
+    return 1;
+}
+
+void BuildingRegistryGetSize(const building_registry_entry *e,
+                             int *width, int *height)
+{
+    const building_info *info = Get_BuildingFromBaseTile(e->tile);
+
+    *width = info->width;
+    *height = info->height;
+}
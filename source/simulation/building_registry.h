@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021, Antonio Niño Díaz
+
+#ifndef SIMULATION_BUILDING_REGISTRY_H__
+#define SIMULATION_BUILDING_REGISTRY_H__
+
+#include <stdint.h>
+
+// The registry holds the top left tile of every building of the map, including
+// RCI zones without buildings, radiation and fire tiles. It doesn't include
+// fields, forests, water, docks, roads, train tracks or power lines. It is
+// updated whenever a tile of the map is modified.
+
+typedef struct {
+    uint8_t x;
+    uint8_t y;
+    uint16_t tile; // Top left tile
+    uint16_t type; // Type of the top left tile
+} building_registry_entry;
+
+// Position of an iterator over the buildings of the registry
+typedef struct {
+    int y;
+    uint64_t row; // Origins of row `y` that haven't been visited yet
+} building_registry_iterator;
+
+// Rebuild the whole registry from the map
+void BuildingRegistryRefresh(void);
+// Update the registry after drawing the specified tile in the map
+void BuildingRegistryUpdate(int x, int y, uint16_t tile);
+
+// Iterate over the buildings in raster order (sorted by the coordinates of
+// their top left tile, first by row and then by column). The entries are
+// generated from the map when they are visited, so there is no list in memory.
+// An iterator is only valid until the next time the map is modified, and it
+// can be copied to resume the iteration from the same position later.
+void BuildingRegistryIteratorStart(building_registry_iterator *it);
+// Returns 1 and fills `e` with the next building, or returns 0 if there are no
+// buildings left.
+int BuildingRegistryIteratorNext(building_registry_iterator *it,
+                                 building_registry_entry *e);
+
+// Returns the size of a building returned by the iterator. It isn't part of the
+// entry because it needs to look for the building in the list of buildings, and
+// most users don't need it.
+void BuildingRegistryGetSize(const building_registry_entry *e,
+                             int *width, int *height);
+
+#endif // SIMULATION_BUILDING_REGISTRY_H__
@@ -12,6 +12,7 @@
 #include "room_game/tileset_info.h"
 #include "simulation/building_density.h"
 #include "simulation/building_count.h"
+#include "simulation/building_registry.h"
 
 #define CITY_HAS_STADIUM        (1 << 0)
 #define CITY_HAS_UNIVERSITY     (1 << 1)
@@ -274,72 +275,65 @@ void Simulation_CalculateStatistics(void)
     population_industrial = 0;
     population_other = 0;
 
-    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
-    {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
-        {
-            uint16_t tile, type;
-            CityMapGetTypeAndTileUnsafe(i, j, &tile, &type);
+    // The building registry only has the top left tile of each building, and
+    // it doesn't include fields, forests, water or docks.
 
-            type &= TYPE_MASK;
+    building_registry_iterator it;
+    building_registry_entry b;
 
-            if ((type == TYPE_FIELD) || (type == TYPE_FOREST) ||
-                (type == TYPE_WATER) || (type == TYPE_DOCK))
-            {
-                continue;
-            }
+    BuildingRegistryIteratorStart(&it);
 
-            // Not the origin of the building, already handled
-            if (BuildingIsCoordinateOrigin(tile) == 0)
-                continue;
+    while (BuildingRegistryIteratorNext(&it, &b))
+    {
+        uint16_t tile = b.tile;
+        uint16_t type = b.type & TYPE_MASK;
 
-            // Add population to the corresponding type variable
+        // Add population to the corresponding type variable
 
-            const city_tile_density_info *di = CityTileDensityInfo(tile);
+        const city_tile_density_info *di = CityTileDensityInfo(tile);
 
-            switch (type)
-            {
-                case TYPE_RESIDENTIAL:
-                    population_residential += di->population;
-                    break;
-                case TYPE_INDUSTRIAL:
-                    population_industrial += di->population;
-                    break;
-                case TYPE_COMMERCIAL:
-                    population_commercial += di->population;
-                    break;
-
-                case TYPE_POLICE_DEPT:
-                case TYPE_FIRE_DEPT:
-                case TYPE_HOSPITAL:
-                case TYPE_PARK:
-                case TYPE_STADIUM:
-                case TYPE_SCHOOL:
-                case TYPE_HIGH_SCHOOL:
-                case TYPE_UNIVERSITY:
-                case TYPE_MUSEUM:
-                case TYPE_LIBRARY:
-                case TYPE_AIRPORT:
-                case TYPE_PORT:
-                case TYPE_POWER_PLANT:
-                case TYPE_RADIATION:
-                    population_other += di->population;
-                    break;
-
-                case TYPE_FIELD:
-                case TYPE_FOREST:
-                case TYPE_WATER:
-                case TYPE_DOCK:
-                case TYPE_FIRE:
-                default:
-                    UGBA_Assert(0);
-                    break;
-            }
+        switch (type)
+        {
+            case TYPE_RESIDENTIAL:
+                population_residential += di->population;
+                break;
+            case TYPE_INDUSTRIAL:
+                population_industrial += di->population;
+                break;
+            case TYPE_COMMERCIAL:
+                population_commercial += di->population;
+                break;
+
+            case TYPE_POLICE_DEPT:
+            case TYPE_FIRE_DEPT:
+            case TYPE_HOSPITAL:
+            case TYPE_PARK:
+            case TYPE_STADIUM:
+            case TYPE_SCHOOL:
+            case TYPE_HIGH_SCHOOL:
+            case TYPE_UNIVERSITY:
+            case TYPE_MUSEUM:
+            case TYPE_LIBRARY:
+            case TYPE_AIRPORT:
+            case TYPE_PORT:
+            case TYPE_POWER_PLANT:
+            case TYPE_RADIATION:
+                population_other += di->population;
+                break;
+
+            case TYPE_FIELD:
+            case TYPE_FOREST:
+            case TYPE_WATER:
+            case TYPE_DOCK:
+            case TYPE_FIRE:
+            default:
+                UGBA_Assert(0);
+                break;
+        }
 
-            // Add population to the global population variable
+        // Add population to the global population variable
 
-            population_total += di->population;
-        }
+        population_total += di->population;
     }
 
     // Save city type to variable
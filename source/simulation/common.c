@@ -19,13 +19,22 @@
 #include "simulation/meltdown.h"
 #include "simulation/pollution.h"
 #include "simulation/power.h"
+#include "simulation/profile.h"
 #include "simulation/services.h"
 #include "simulation/technology.h"
 #include "simulation/traffic.h"
 
+// Cache of the type of all the tiles of the map. The functions that modify the
+// map keep it up to date, so the simulation can read the type of a tile from
+// here instead of looking up the tileset information of the tile.
 //EWRAM_BSS
 static uint8_t type_matrix[CITY_MAP_WIDTH * CITY_MAP_HEIGHT];
 
+// Bitplanes of the tiles of type TYPE_FIRE and TYPE_RADIATION, kept up to date
+// with type_matrix
+EWRAM_BSS static uint64_t fire_plane[CITY_MAP_HEIGHT];
+EWRAM_BSS static uint64_t radiation_plane[CITY_MAP_HEIGHT];
+
 // ----------------------------------------------------------------------------
 
 static int disasters_enabled;
@@ -57,18 +66,45 @@ void TypeMatrixRefresh(void)
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
         for (int i = 0; i < CITY_MAP_WIDTH; i++)
-        {
-            uint16_t type = CityMapGetType(i, j);
-            type_matrix[j * CITY_MAP_WIDTH + i] = type;
-        }
+            TypeMatrixUpdate(i, j, CityMapGetTile(i, j));
     }
 }
 
+void TypeMatrixUpdate(int x, int y, uint16_t tile)
+{
+    const city_tile_info *tile_info = City_Tileset_Entry_Info(tile);
+    uint8_t type = tile_info->element_type;
+
+    type_matrix[y * CITY_MAP_WIDTH + x] = type;
+
+    uint64_t mask = (uint64_t)1 << x;
+
+    if (type == TYPE_FIRE)
+        fire_plane[y] |= mask;
+    else
+        fire_plane[y] &= ~mask;
+
+    if (type == TYPE_RADIATION)
+        radiation_plane[y] |= mask;
+    else
+        radiation_plane[y] &= ~mask;
+}
+
 uint8_t *TypeMatrixGet(void)
 {
     return &type_matrix[0];
 }
 
+const uint64_t *TypeMatrixGetFirePlane(void)
+{
+    return &fire_plane[0];
+}
+
+const uint64_t *TypeMatrixGetRadiationPlane(void)
+{
+    return &radiation_plane[0];
+}
+
 static int first_simulation_iteration = 1;
 
 void Simulation_SetFirstStep(void)
@@ -105,9 +141,13 @@ void Simulation_SimulateAll(void)
 {
     // Simulate disasters if in disaster mode
 
+    SIM_PROFILE_STEP_START();
+
     if (Room_Game_IsInDisasterMode())
     {
         Simulation_Fire();
+        SIM_PROFILE_MARK(SIM_PHASE_FIRE);
+        SIM_PROFILE_STEP_END();
         return;
     }
 
@@ -119,60 +159,58 @@ void Simulation_SimulateAll(void)
     if (first_simulation_iteration == 0)
         Simulation_CreateBuildings();
 
+    SIM_PROFILE_MARK(SIM_PHASE_CREATE_BUILDINGS);
+
     // Now, simulate this new map. First, power distribution, as it will be
     // needed for other simulations
 
     Simulation_PowerDistribution();
+    SIM_PROFILE_MARK(SIM_PHASE_POWER);
 
     // After knowing the power distribution, the rest of the simulations can
     // be done.
 
     Simulation_Traffic();
+    SIM_PROFILE_MARK(SIM_PHASE_TRAFFIC);
 
     // Simulate services, like police and firemen. They depend on the power
     // simulation, as they can't work without electricity, so handle this
     // after simulating the power grid.
 
-    Simulation_Services(T_POLICE_DEPT_CENTER);
-    Simulation_ServicesSetTileOkFlag();
+    uint32_t services = (1 << SERVICE_POLICE) | (1 << SERVICE_SCHOOL);
 
     int city_class = Simulation_GetCityClass();
 
-    if (city_class >= CLASS_VILLAGE)
-    {
-        // Ignore if the city is too small
-
-        Simulation_Services(T_FIRE_DEPT_CENTER);
-        Simulation_ServicesAddTileOkFlag();
-
-        Simulation_Services(T_HOSPITAL_CENTER);
-        Simulation_ServicesAddTileOkFlag();
-    }
-
-    Simulation_Services(T_SCHOOL_CENTER);
-    Simulation_EducationSetTileOkFlag();
+    // Ignore the rest of services if the city is too small
 
     if (city_class >= CLASS_VILLAGE)
     {
-        Simulation_ServicesBig(T_HIGH_SCHOOL_CENTER);
-        Simulation_EducationAddTileOkFlag();
+        services |= (1 << SERVICE_FIRE) | (1 << SERVICE_HOSPITAL) |
+                    (1 << SERVICE_HIGH_SCHOOL);
     }
 
+    Simulation_ServicesAll(services);
+    SIM_PROFILE_MARK(SIM_PHASE_SERVICES);
+
     // After simulating traffic, power, etc, simulate pollution
 
     Simulation_Pollution();
+    SIM_PROFILE_MARK(SIM_PHASE_POLLUTION);
 
     // After simulating, flag buildings to be created or demolished.
 
     Simulation_FlagCreateBuildings();
+    SIM_PROFILE_MARK(SIM_PHASE_FLAG_CREATE_BUILDINGS);
 
     // Calculate total population and other statistics
 
     Simulation_CalculateStatistics();
+    SIM_PROFILE_MARK(SIM_PHASE_STATISTICS);
 
     // Calculate RCI graph
 
     Simulation_CalculateRCIDemand();
+    SIM_PROFILE_MARK(SIM_PHASE_RCI_DEMAND);
 
     // Update date, apply budget, etc.
     // Note: Only if this is not the first iteration step! The first iteration
@@ -219,6 +257,8 @@ void Simulation_SimulateAll(void)
         }
     }
 
+    SIM_PROFILE_MARK(SIM_PHASE_DATE_BUDGET);
+
     // Start disasters if there isn't one active
 
     int force_fire = (requested_disaster == REQUESTED_DISASTER_FIRE);
@@ -232,13 +272,19 @@ void Simulation_SimulateAll(void)
         requested_disaster = REQUESTED_DISASTER_NONE;
     }
 
+    SIM_PROFILE_MARK(SIM_PHASE_DISASTERS);
+
     // Remove radiation
 
     Simulation_Radiation();
+    SIM_PROFILE_MARK(SIM_PHASE_RADIATION);
 
     // Handle historical records
 
     GraphHandleRecords();
+    SIM_PROFILE_MARK(SIM_PHASE_GRAPHS);
 
     // End of this simulation step
+
+    SIM_PROFILE_STEP_END();
 }
@@ -5,6 +5,8 @@
 #ifndef SIMULATION_COMMON_H__
 #define SIMULATION_COMMON_H__
 
+#include <stdint.h>
+
 void Simulation_GraphsResetAll(void);
 
 typedef enum {
@@ -17,8 +19,15 @@ void Simulation_DisastersSetEnabled(int enable);
 int Simulation_AreDisastersEnabled(void);
 void Simulation_RequestDisaster(requested_disaster_type type);
 
+// Rebuild the whole cache of types from the map
 void TypeMatrixRefresh(void);
+// Update the type of one tile of the map after drawing the specified tile
+void TypeMatrixUpdate(int x, int y, uint16_t tile);
 uint8_t *TypeMatrixGet(void);
+// Bitplanes of the tiles of type TYPE_FIRE and TYPE_RADIATION (one 64-bit word
+// per row)
+const uint64_t *TypeMatrixGetFirePlane(void);
+const uint64_t *TypeMatrixGetRadiationPlane(void);
 
 void Simulation_SetFirstStep(void);
 void Simulation_SimulateAll(void);
@@ -15,6 +15,7 @@
 #include "room_game/room_game.h"
 #include "room_game/tileset_info.h"
 #include "simulation/budget.h"
+#include "simulation/common.h"
 #include "simulation/happiness.h"
 #include "simulation/pollution.h"
 #include "simulation/traffic.h"
@@ -60,67 +61,59 @@ EWRAM_BSS static uint8_t building_level[CITY_MAP_WIDTH * CITY_MAP_HEIGHT];
 // only calculated for RCI type zones!
 IWRAM_CODE void Simulation_FlagCreateBuildings(void)
 {
+    const uint8_t *type_matrix = TypeMatrixGet();
+
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
+        const uint8_t *type_row = &type_matrix[j * CITY_MAP_WIDTH];
+
+        // Masks of the RCI tiles of this row
+
+        uint64_t r_mask = 0;
+        uint64_t c_mask = 0;
+        uint64_t i_mask = 0;
+
         for (int i = 0; i < CITY_MAP_WIDTH; i++)
         {
-            uint16_t type = CityMapGetType(i, j);
-            int flags = Simulation_HappinessGetFlags(i, j);
-            uint8_t result = COMMAND_DO_NOTHING;
+            uint16_t type = type_row[i];
 
             if (type == TYPE_RESIDENTIAL)
-            {
-                if ((flags & R_DESIRED) == R_DESIRED)
-                {
-                    // Build
-                    result = COMMAND_BUILD;
-                }
-                else if ((flags & R_NEEDED) == R_NEEDED)
-                {
-                    // Do nothing
-                }
-                else
-                {
-                    // Demolish
-                    result = COMMAND_DEMOLISH;
-                }
-            }
+                r_mask |= (uint64_t)1 << i;
             else if (type == TYPE_COMMERCIAL)
-            {
-                if ((flags & C_DESIRED) == C_DESIRED)
-                {
-                    // Build
-                    result = COMMAND_BUILD;
-                }
-                else if ((flags & C_NEEDED) == C_NEEDED)
-                {
-                    // Do nothing
-                }
-                else
-                {
-                    // Demolish
-                    result = COMMAND_DEMOLISH;
-                }
-            }
+                c_mask |= (uint64_t)1 << i;
             else if (type == TYPE_INDUSTRIAL)
-            {
-                if ((flags & I_DESIRED) == I_DESIRED)
-                {
-                    // Build
-                    result = COMMAND_BUILD;
-                }
-                else if ((flags & I_NEEDED) == I_NEEDED)
-                {
-                    // Do nothing
-                }
-                else
-                {
-                    // Demolish
-                    result = COMMAND_DEMOLISH;
-                }
-            }
+                i_mask |= (uint64_t)1 << i;
+        }
+
+        // Build if all the desired flags are set. If not, do nothing if all
+        // the needed flags are set. Demolish in any other case.
 
-            building_command[j * CITY_MAP_WIDTH + i] = result;
+        uint64_t r_desired = Simulation_HappinessRowHasFlags(j, R_DESIRED);
+        uint64_t r_needed = Simulation_HappinessRowHasFlags(j, R_NEEDED);
+        uint64_t c_desired = Simulation_HappinessRowHasFlags(j, C_DESIRED);
+        uint64_t c_needed = Simulation_HappinessRowHasFlags(j, C_NEEDED);
+        uint64_t i_desired = Simulation_HappinessRowHasFlags(j, I_DESIRED);
+        uint64_t i_needed = Simulation_HappinessRowHasFlags(j, I_NEEDED);
+
+        uint64_t build = (r_mask & r_desired) | (c_mask & c_desired) |
+                         (i_mask & i_desired);
+
+        uint64_t demolish = (r_mask & ~(r_desired | r_needed)) |
+                            (c_mask & ~(c_desired | c_needed)) |
+                            (i_mask & ~(i_desired | i_needed));
+
+        uint8_t *command_row = &building_command[j * CITY_MAP_WIDTH];
+
+        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        {
+            uint8_t result = COMMAND_DO_NOTHING;
+
+            if ((build >> i) & 1)
+                result = COMMAND_BUILD;
+            else if ((demolish >> i) & 1)
+                result = COMMAND_DEMOLISH;
+
+            command_row[i] = result;
         }
     }
 }
@@ -578,6 +571,8 @@ build_building:
 // one of these changes.
 IWRAM_CODE void Simulation_CreateBuildings(void)
 {
+    const uint8_t *type_matrix = TypeMatrixGet();
+
     // The probability of creating and destroying buildings depend on the amount
     // of taxes.
 
@@ -653,7 +648,7 @@ IWRAM_CODE void Simulation_CreateBuildings(void)
     {
         for (int i = 0; i < CITY_MAP_WIDTH; i++)
         {
-            uint16_t type = CityMapGetType(i, j);
+            uint16_t type = type_matrix[j * CITY_MAP_WIDTH + i];
 
             if ((type != TYPE_RESIDENTIAL) && (type != TYPE_COMMERCIAL) &&
                 (type != TYPE_INDUSTRIAL))
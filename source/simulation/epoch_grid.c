@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021, Antonio Niño Díaz
+
+#include <stdint.h>
+#include <string.h>
+
+#include <ugba/ugba.h>
+
+#include "simulation/epoch_grid.h"
+
+IWRAM_CODE void EpochGridNewEpoch(epoch_grid *g)
+{
+    g->epoch++;
+
+    // When the counter wraps around, the stamps of the cells that haven't been
+    // written in a long time could match the new epoch, so clear all of them.
+    // Epoch 0 is never used so that cleared stamps are always stale.
+    if (g->epoch == 0)
+    {
+        memset(g->stamp, 0, g->size * sizeof(g->stamp[0]));
+        g->epoch = 1;
+    }
+}
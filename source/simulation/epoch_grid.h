@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021, Antonio Niño Díaz
+
+#ifndef SIMULATION_EPOCH_GRID_H__
+#define SIMULATION_EPOCH_GRID_H__
+
+#include <stdint.h>
+
+// Grid of cells tagged with the epoch in which they have been written. Starting
+// a new epoch invalidates all cells at once, so the data associated to the
+// cells doesn't need to be cleared before reusing it. Only the cells that are
+// written in the current epoch need to be initialized.
+
+typedef struct {
+    uint8_t *stamp;     // Epoch in which each cell has been written
+    int size;           // Number of cells
+    uint8_t epoch;      // Current epoch
+} epoch_grid;
+
+// Initializer of a grid that uses the specified array to store the epochs:
+//
+//     static uint8_t stamps[SIZE];
+//     static epoch_grid g = EPOCH_GRID_INITIALIZER(stamps);
+#define EPOCH_GRID_INITIALIZER(array) \
+    { .stamp = (array), .size = sizeof(array) / sizeof((array)[0]) }
+
+// Check if a cell has been written in the current epoch
+#define EPOCH_GRID_IS_CURRENT(g, index) \
+    ((g)->stamp[(index)] == (g)->epoch)
+
+// Flag a cell as written in the current epoch
+#define EPOCH_GRID_TOUCH(g, index) \
+    ((g)->stamp[(index)] = (g)->epoch)
+
+// Start a new epoch. All cells are considered stale after calling it. It must
+// be called before using a grid for the first time. The stamps are 8-bit
+// values, so all of them are cleared once every 255 epochs.
+void EpochGridNewEpoch(epoch_grid *g);
+
+#endif // SIMULATION_EPOCH_GRID_H__
@@ -2,8 +2,8 @@
 //
 // Copyright (c) 2021, Antonio Niño Díaz
 
+#include <stdint.h>
 #include <stdlib.h>
-#include <string.h>
 
 #include <ugba/ugba.h>
 
@@ -17,6 +17,7 @@
 #include "room_game/tileset_info.h"
 #include "simulation/building_density.h"
 #include "simulation/building_count.h"
+#include "simulation/common.h"
 #include "simulation/meltdown.h"
 #include "simulation/traffic.h"
 #include "simulation/transport_anims.h"
@@ -32,8 +33,15 @@
 
 static int initial_number_fire_stations;
 
+// Each tile can receive fire from the 4 neighbours. This map holds the sum of
+// the probabilities of each tile to catch fire from all of its neighbours. The
+// entries are cleared as soon as they are used, so the map is always empty
+// between simulation steps.
 EWRAM_BSS static uint8_t fire_map[CITY_MAP_WIDTH * CITY_MAP_HEIGHT];
 
+// Bitplane of the tiles with a value different from 0 in fire_map[]
+EWRAM_BSS static uint64_t fire_candidates[CITY_MAP_HEIGHT];
+
 // Removes a building and replaces it with fire. Fire SFX
 void MapDeleteBuildingFire(int x, int y)
 {
@@ -210,6 +218,7 @@ static void Simulation_FireExpand(int x, int y)
             if (val > 255)
                 val = 255;
             fire_map[ty * CITY_MAP_WIDTH + tx] = val;
+            fire_candidates[ty] |= (uint64_t)1 << tx;
         }
     }
 
@@ -229,6 +238,7 @@ static void Simulation_FireExpand(int x, int y)
             if (val > 255)
                 val = 255;
             fire_map[ty * CITY_MAP_WIDTH + tx] = val;
+            fire_candidates[ty] |= (uint64_t)1 << tx;
         }
     }
 
@@ -248,6 +258,7 @@ static void Simulation_FireExpand(int x, int y)
             if (val > 255)
                 val = 255;
             fire_map[ty * CITY_MAP_WIDTH + tx] = val;
+            fire_candidates[ty] |= (uint64_t)1 << tx;
         }
     }
 
@@ -267,6 +278,7 @@ static void Simulation_FireExpand(int x, int y)
             if (val > 255)
                 val = 255;
             fire_map[ty * CITY_MAP_WIDTH + tx] = val;
+            fire_candidates[ty] |= (uint64_t)1 << tx;
         }
     }
 
@@ -283,29 +295,33 @@ static void Simulation_FireExpand(int x, int y)
 
 void Simulation_Fire(void)
 {
-    // This should only be called during disaster mode!
+    // The fire tiles are taken from the bitplane of the type matrix in raster
+    // order, so that rand_slow() is called in the same order as if the whole
+    // map was scanned. A copy of each row is used because the tiles of the
+    // fire may be removed while the row is being handled.
 
-    // Clear
-    // -----
+    const uint64_t *fire_plane = TypeMatrixGetFirePlane();
 
-    // Each tile can receive fire from the 4 neighbours. In this bank the code
-    // adds the probabilities of the tile to catch fire as many times as needed
-    // (e.g. 2 neighbours with fire, 2 x probabilities). Afterwards, a random
-    // number is generated for each tile and if it is lower the tile catches
-    // fire or not.
+    // This should only be called during disaster mode!
 
-    memset(fire_map, 0, sizeof(fire_map));
+    // For each tile of type TYPE_FIRE try to expand fire
+    // --------------------------------------------------
 
-    // For each tile check if it is type TYPE_FIRE and try to expand fire
-    // ------------------------------------------------------------------
+    // The code adds the probabilities of the neighbours of the fire to catch
+    // fire as many times as needed (e.g. 2 neighbours with fire, 2 x
+    // probabilities). Afterwards, a random number is generated for each tile
+    // and if it is lower the tile catches fire or not.
 
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        uint64_t row = fire_plane[j];
+
+        while (row != 0)
         {
-            uint16_t type = CityMapGetType(i, j);
-            if (type == TYPE_FIRE)
-                Simulation_FireExpand(i, j);
+            int i = __builtin_ctzll(row);
+            row &= row - 1;
+
+            Simulation_FireExpand(i, j);
         }
     }
 
@@ -323,11 +339,12 @@ void Simulation_Fire(void)
 
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        uint64_t row = fire_plane[j];
+
+        while (row != 0)
         {
-            uint16_t type = CityMapGetType(i, j);
-            if (type != TYPE_FIRE)
-                continue;
+            int i = __builtin_ctzll(row);
+            row &= row - 1;
 
             int r = rand_slow() & 0xFF;
             if (r < extinguish_fire_probability)
@@ -340,12 +357,16 @@ void Simulation_Fire(void)
 
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        uint64_t row = fire_candidates[j];
+        fire_candidates[j] = 0;
+
+        while (row != 0)
         {
-            int val = fire_map[j * CITY_MAP_WIDTH + i];
+            int i = __builtin_ctzll(row);
+            row &= row - 1;
 
-            if (val == 0)
-                continue;
+            int val = fire_map[j * CITY_MAP_WIDTH + i];
+            fire_map[j * CITY_MAP_WIDTH + i] = 0;
 
             int r = rand_slow() & 0xFF;
             if (r < val)
@@ -358,12 +379,8 @@ void Simulation_Fire(void)
 
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
-        {
-            uint16_t type = CityMapGetType(i, j);
-            if (type == TYPE_FIRE)
-                return;
-        }
+        if (fire_plane[j] != 0)
+            return;
     }
 
     // If not found fire, go back to normal mode
@@ -380,10 +397,17 @@ void Simulation_Fire(void)
 
 void Simulation_FireAnimate(void)
 {
+    const uint64_t *fire_plane = TypeMatrixGetFirePlane();
+
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        uint64_t row = fire_plane[j];
+
+        while (row != 0)
         {
+            int i = __builtin_ctzll(row);
+            row &= row - 1;
+
             uint16_t tile = CityMapGetTile(i, j);
             if (tile == T_FIRE_1)
                 CityMapDrawTile(T_FIRE_2, i, j);
@@ -10,29 +10,85 @@
 #include "simulation/happiness.h"
 #include "room_game/room_game.h"
 
+// The flags are stored as bitplanes. Each flag has one 64-bit word per row of
+// the map, and bit N of each word is the flag of column N of that row. This
+// way the simulation can set, reset and combine the flags of a whole row with
+// a few operations.
+
+#if CITY_MAP_WIDTH != 64
+#error "Each row of a bitplane must fit in a 64-bit word"
+#endif
+
+EWRAM_BSS static
+uint64_t happiness_planes[HAPPINESS_NUM_PLANES][CITY_MAP_HEIGHT];
+
+// Map with one byte per tile, only generated on request
 EWRAM_BSS static uint8_t happiness_map[CITY_MAP_HEIGHT * CITY_MAP_WIDTH];
 
+uint64_t *Simulation_HappinessGetPlane(int flag_bit)
+{
+    UGBA_Assert(flag_bit < HAPPINESS_NUM_PLANES);
+    return &happiness_planes[flag_bit][0];
+}
+
+IWRAM_CODE uint64_t Simulation_HappinessRowHasFlags(int y, uint8_t flags)
+{
+    uint64_t result = UINT64_MAX;
+
+    for (int b = 0; b < HAPPINESS_NUM_PLANES; b++)
+    {
+        if (flags & (1 << b))
+            result &= happiness_planes[b][y];
+    }
+
+    return result;
+}
+
 uint8_t *Simulation_HappinessGetMap(void)
 {
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+            happiness_map[j * CITY_MAP_WIDTH + i] =
+                    Simulation_HappinessGetFlags(i, j);
+    }
+
     return &happiness_map[0];
 }
 
 uint8_t Simulation_HappinessGetFlags(int x, int y)
 {
-    return happiness_map[y * CITY_MAP_WIDTH + x];
+    uint8_t flags = 0;
+
+    for (int b = 0; b < HAPPINESS_NUM_PLANES; b++)
+        flags |= ((happiness_planes[b][y] >> x) & 1) << b;
+
+    return flags;
 }
 
 void Simulation_HappinessSetFlags(int x, int y, uint8_t flags)
 {
-    happiness_map[y * CITY_MAP_WIDTH + x] |= flags;
+    uint64_t mask = (uint64_t)1 << x;
+
+    for (int b = 0; b < HAPPINESS_NUM_PLANES; b++)
+    {
+        if (flags & (1 << b))
+            happiness_planes[b][y] |= mask;
+    }
 }
 
 void Simulation_HappinessResetFlags(int x, int y, uint8_t flags)
 {
-    happiness_map[y * CITY_MAP_WIDTH + x] &= ~flags;
+    uint64_t mask = (uint64_t)1 << x;
+
+    for (int b = 0; b < HAPPINESS_NUM_PLANES; b++)
+    {
+        if (flags & (1 << b))
+            happiness_planes[b][y] &= ~mask;
+    }
 }
 
 void Simulation_HappinessResetMap(void)
 {
-    memset(happiness_map, 0, sizeof(happiness_map));
+    memset(happiness_planes, 0, sizeof(happiness_planes));
 }
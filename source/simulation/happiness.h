@@ -7,6 +7,21 @@
 
 #include <stdint.h>
 
+#include "room_game/room_game.h"
+
+// Only the TILE_OK_xxx flags are stored
+#define HAPPINESS_NUM_PLANES    (TILE_OK_TRAFFIC_BIT + 1)
+
+// Returns the bitplane of the specified TILE_OK_xxx_BIT flag. It is an array
+// with one word per row of the map. Bit N of a word is the flag of column N.
+uint64_t *Simulation_HappinessGetPlane(int flag_bit);
+
+// Returns a mask with the tiles of row y that have all the specified flags set
+uint64_t Simulation_HappinessRowHasFlags(int y, uint8_t flags);
+
+// Returns a map with the flags of all tiles, one byte per tile. It is generated
+// from the bitplanes every time this function is called, and modifying it
+// doesn't have any effect.
 uint8_t *Simulation_HappinessGetMap(void);
 
 uint8_t Simulation_HappinessGetFlags(int x, int y);
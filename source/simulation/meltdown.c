@@ -2,6 +2,7 @@
 //
 // Copyright (c) 2021 Antonio Niño Díaz
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #include <ugba/ugba.h>
@@ -15,6 +16,7 @@
 #include "room_game/tileset_info.h"
 #include "simulation/building_density.h"
 #include "simulation/building_count.h"
+#include "simulation/common.h"
 #include "simulation/fire.h"
 #include "simulation/traffic.h"
 #include "simulation/transport_anims.h"
@@ -23,15 +25,20 @@ void Simulation_Radiation(void)
 {
     // Remove radiation
 
+    // The radiation tiles are taken from the bitplane of the type matrix in
+    // raster order, so rand_slow() is called in the same order as if the whole
+    // map was scanned. If there is no radiation this is almost free.
+
+    const uint64_t *radiation_plane = TypeMatrixGetRadiationPlane();
+
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
-        {
-            uint16_t tile, type;
-            CityMapGetTypeAndTile(i, j, &tile, &type);
+        uint64_t row = radiation_plane[j];
 
-            if (type != TYPE_RADIATION)
-                continue;
+        while (row != 0)
+        {
+            int i = __builtin_ctzll(row);
+            row &= row - 1;
 
             // Only remove radiation if rand_slow() = 0 (1 in 256 chance)
             int r = rand_slow() & 0xFF;
@@ -40,6 +47,8 @@ void Simulation_Radiation(void)
 
             // If water, set to water again. If ground, set to ground
 
+            uint16_t tile = CityMapGetTile(i, j);
+
             if (tile == T_RADIATION_GROUND)
             {
                 CityMapDrawTile(T_GRASS, i, j);
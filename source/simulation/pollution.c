@@ -5,6 +5,10 @@
 #include <stdint.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <ugba/ugba.h>
 
 #include "room_game/building_info.h"
@@ -13,6 +17,7 @@
 #include "room_game/text_messages.h"
 #include "room_game/tileset_info.h"
 #include "simulation/building_density.h"
+#include "simulation/common.h"
 #include "simulation/happiness.h"
 #include "simulation/pollution.h"
 #include "simulation/traffic.h"
@@ -21,11 +26,28 @@
 #define POLLUTION_MAX_VALID_LEVEL   (256 / 2)
 
 EWRAM_BSS uint8_t scratch_map_1[CITY_MAP_WIDTH * CITY_MAP_HEIGHT];
-EWRAM_BSS uint8_t scratch_map_2[CITY_MAP_WIDTH * CITY_MAP_HEIGHT];
 
-// Total pollution in the city. Max value = 255 * 64 * 64
+// Pollution generated by each tile before diffuminating it. It is kept between
+// simulation steps so that only the parts of the map that have changed are
+// updated. The map starts empty, which is consistent with no sources at all.
+EWRAM_BSS static uint8_t pollution_sources[CITY_MAP_WIDTH * CITY_MAP_HEIGHT];
+
+// Total pollution in the city (sum of all sources). Max value = 255 * 64 * 64
 static int pollution_total;
 
+// Bitboards with one bit per tile. They are always up to date.
+//
+// - Roads, whose pollution is the traffic that goes through them.
+// - Tiles that don't need clean air (see ignore_tile_array[]).
+EWRAM_BSS static uint64_t pollution_road_tiles[CITY_MAP_HEIGHT];
+EWRAM_BSS static uint64_t pollution_ignore_tiles[CITY_MAP_HEIGHT];
+
+// Tiles whose source of pollution may have changed since the last step
+// because of a change in the map (changes in the traffic are tracked by the
+// traffic simulation), and rows whose pollution ignore flags have changed.
+EWRAM_BSS static uint64_t pollution_changed_tiles[CITY_MAP_HEIGHT];
+static uint64_t pollution_changed_rows;
+
 // Percentage of pollution
 static int pollution_total_percent;
 
@@ -44,146 +66,278 @@ uint8_t *Simulation_PollutionGetMap(void)
     return &scratch_map_1[0];
 }
 
-IWRAM_CODE static void Diffuminate_Central_Tile(uint8_t *src, uint8_t *dst,
-                                                int i, int j)
+// The pollution map is diffuminated several times in a row. Each iteration
+// replaces each tile by the sum of the tile and its 4 neighbours divided by 3,
+// saturated to 255. Tiles outside of the map have the value of the closest tile
+// of the map, so rows are stored with one extra tile at each side.
+
+#define DIFFUMINATE_ITERATIONS      4
+
+#define DIFFUMINATE_ROW_SIZE        (CITY_MAP_WIDTH + 2)
+
+// The iterations are done one row at a time. Each iteration needs 3 rows of
+// the previous one (stage 0 holds the rows of the original map).
+static uint8_t diffuminate_rows[DIFFUMINATE_ITERATIONS + 1][3]
+                               [DIFFUMINATE_ROW_SIZE];
+
+IWRAM_CODE static void Diffuminate_Row(const uint8_t *up, const uint8_t *center,
+                                       const uint8_t *down, uint8_t *dst)
 {
-    uint32_t total = 0;
-    uint32_t weight = 5;
-    uint32_t result;
+    int i = 0;
 
-    if (j > 0) // Top row
-    {
-        total += (uint32_t)src[(j - 1) * CITY_MAP_WIDTH + i];
-        weight--;
-    }
+#ifdef __SSE2__
+    // x / 3 == (x * 0xAAAB) >> 17 for all 16-bit values of x. The final
+    // saturation to 255 is done when packing the results to 8 bits.
 
-    if (j < (CITY_MAP_HEIGHT - 1)) // Bottom row
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i div3 = _mm_set1_epi16((short)0xAAAB);
+
+    for ( ; i < CITY_MAP_WIDTH - 15; i += 16)
     {
-        total += (uint32_t)src[(j + 1) * CITY_MAP_WIDTH + i];
-        weight--;
+        __m128i u = _mm_loadu_si128((const __m128i *)&up[i + 1]);
+        __m128i d = _mm_loadu_si128((const __m128i *)&down[i + 1]);
+        __m128i l = _mm_loadu_si128((const __m128i *)&center[i]);
+        __m128i c = _mm_loadu_si128((const __m128i *)&center[i + 1]);
+        __m128i r = _mm_loadu_si128((const __m128i *)&center[i + 2]);
+
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(u, zero),
+                                   _mm_unpacklo_epi8(d, zero));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(l, zero));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(c, zero));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(r, zero));
+
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(u, zero),
+                                   _mm_unpackhi_epi8(d, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(l, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(c, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(r, zero));
+
+        lo = _mm_srli_epi16(_mm_mulhi_epu16(lo, div3), 1);
+        hi = _mm_srli_epi16(_mm_mulhi_epu16(hi, div3), 1);
+
+        _mm_storeu_si128((__m128i *)&dst[i + 1], _mm_packus_epi16(lo, hi));
     }
+#endif
 
-    if (i > 0) // Left column
+    for ( ; i < CITY_MAP_WIDTH; i++)
     {
-        total += (uint32_t)src[j * CITY_MAP_WIDTH + (i - 1)];
-        weight--;
+        uint32_t total = (uint32_t)up[i + 1] + (uint32_t)down[i + 1] +
+                         (uint32_t)center[i] + (uint32_t)center[i + 1] +
+                         (uint32_t)center[i + 2];
+
+        // Saturate
+
+        if (total > (255 * 3))
+            dst[i + 1] = 255;
+        else
+            dst[i + 1] = total / 3;
     }
 
-    if (i < (CITY_MAP_WIDTH - 1)) // Right column
+    dst[0] = dst[1];
+    dst[CITY_MAP_WIDTH + 1] = dst[CITY_MAP_WIDTH];
+}
+
+IWRAM_CODE static const uint8_t *Diffuminate_GetRow(int stage, int row)
+{
+    // Rows outside of the map are the same as the closest row of the map
+
+    if (row < 0)
+        row = 0;
+    else if (row >= CITY_MAP_HEIGHT)
+        row = CITY_MAP_HEIGHT - 1;
+
+    return &diffuminate_rows[stage][row % 3][0];
+}
+
+// Diffuminates the sources of pollution DIFFUMINATE_ITERATIONS times and saves
+// rows `first` to `last` of the result. Iteration N can calculate a row as soon
+// as iteration N - 1 has calculated the row below it, so all iterations advance
+// together over the map, and the only rows that need to be kept are 3 rows per
+// iteration.
+IWRAM_CODE static void Diffuminate_Rows(const uint8_t *src, uint8_t *dst,
+                                        int first, int last)
+{
+    const int n = DIFFUMINATE_ITERATIONS;
+
+    for (int r = first - n; r <= last + 2 * n; r++)
     {
-        total += (uint32_t)src[j * CITY_MAP_WIDTH + (i + 1)];
-        weight--;
-    }
+        // Each iteration needs one more row at each side than the next one,
+        // up to the borders of the map.
 
-    total += weight * (uint32_t)src[j * CITY_MAP_WIDTH + i];
+        if ((r >= 0) && (r < CITY_MAP_HEIGHT) && (r <= last + n))
+        {
+            uint8_t *row = &diffuminate_rows[0][r % 3][0];
 
-    // Saturate
+            memcpy(&row[1], &src[r * CITY_MAP_WIDTH], CITY_MAP_WIDTH);
+            row[0] = row[1];
+            row[CITY_MAP_WIDTH + 1] = row[CITY_MAP_WIDTH];
+        }
 
-    if (total > (255 * 3))
-        result = 255;
-    else
-        result = total / 3;
+        for (int k = 1; k <= n; k++)
+        {
+            int row = r - k;
+
+            if ((row < 0) || (row >= CITY_MAP_HEIGHT))
+                continue;
+
+            if ((row < first - (n - k)) || (row > last + (n - k)))
+                continue;
+
+            Diffuminate_Row(Diffuminate_GetRow(k - 1, row - 1),
+                            Diffuminate_GetRow(k - 1, row),
+                            Diffuminate_GetRow(k - 1, row + 1),
+                            &diffuminate_rows[k][row % 3][0]);
+        }
+
+        int row = r - n;
 
-    dst[j * CITY_MAP_WIDTH + i] = result;
+        if ((row >= first) && (row <= last))
+        {
+            memcpy(&dst[row * CITY_MAP_WIDTH],
+                   &diffuminate_rows[n][row % 3][1], CITY_MAP_WIDTH);
+        }
+    }
 }
 
-IWRAM_CODE static void Diffuminate_Loop(uint8_t *src, uint8_t *dst)
+// List of terrains that ignore the pollution level. In general, any terrain
+// that generates pollution ignores it. This is only used for buildings, so no
+// need to check fields, forests or water zones.
+//
+// This array says whether a particular tile type has to be checked for
+// pollution or not. Type flags should be removed before accesing it.
+//
+// 1 = ignore this tile, 0 = handle pollution
+static const uint8_t ignore_tile_array[] = {
+    [TYPE_FIELD] = 1, // There's nothing here, don't check...
+    [TYPE_FOREST] = 1,
+    [TYPE_WATER] = 1,
+    [TYPE_RESIDENTIAL] = 0, // R and C must be clean. I generates pollution.
+    [TYPE_INDUSTRIAL] = 1,
+    [TYPE_COMMERCIAL] = 0,
+    [TYPE_POLICE_DEPT] = 1, // Services are supposed to work even in very
+    [TYPE_FIRE_DEPT] = 1,   //  polluted areas.
+    [TYPE_HOSPITAL] = 1,
+    [TYPE_PARK] = 0, // Recreation and education, they must be clean.
+    [TYPE_STADIUM] = 0,
+    [TYPE_SCHOOL] = 0,
+    [TYPE_HIGH_SCHOOL] = 0,
+    [TYPE_UNIVERSITY] = 0,
+    [TYPE_MUSEUM] = 0,
+    [TYPE_LIBRARY] = 0,
+    [TYPE_AIRPORT] = 1, // The tiles below generate pollution, so it's
+    [TYPE_PORT] = 1,    // illogical to ask for no pollution there.
+    [TYPE_DOCK] = 1,
+    [TYPE_POWER_PLANT] = 1,
+    [TYPE_FIRE] = 0, // Simulation should be off during fires.
+    [TYPE_RADIATION] = 1, // Ignore pollution here
+};
+
+void PollutionSourcesRefresh(void)
 {
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
         for (int i = 0; i < CITY_MAP_WIDTH; i++)
-            Diffuminate_Central_Tile(src, dst, i, j);
+            PollutionSourcesUpdate(i, j, CityMapGetTile(i, j));
+
+        pollution_changed_tiles[j] = UINT64_MAX;
     }
+
+    pollution_changed_rows = UINT64_MAX;
 }
 
-IWRAM_CODE static void Simulation_PollutionSetTileOkFlag(void)
+// The traffic simulation redraws all roads in every step, so tiles are only
+// flagged as changed if their source of pollution can be different from the
+// one used in the last step.
+IWRAM_CODE void PollutionSourcesUpdate(int x, int y, uint16_t tile)
 {
-    // List of terrains that ignore the pollution level. In general, any terrain
-    // that generates pollution ignores it. This is only used for buildings, so
-    // no need to check fields, forests or water zones.
-    //
-    // This array says whether a particular tile type has to be checked for
-    // pollution or not. Type flags should be removed before accesing it.
-    //
-    // 1 = ignore this tile, 0 = handle pollution
-    const uint8_t ignore_tile_array[] = {
-        [TYPE_FIELD] = 1, // There's nothing here, don't check...
-        [TYPE_FOREST] = 1,
-        [TYPE_WATER] = 1,
-        [TYPE_RESIDENTIAL] = 0, // R and C must be clean. I generates pollution.
-        [TYPE_INDUSTRIAL] = 1,
-        [TYPE_COMMERCIAL] = 0,
-        [TYPE_POLICE_DEPT] = 1, // Services are supposed to work even in very
-        [TYPE_FIRE_DEPT] = 1,   //  polluted areas.
-        [TYPE_HOSPITAL] = 1,
-        [TYPE_PARK] = 0, // Recreation and education, they must be clean.
-        [TYPE_STADIUM] = 0,
-        [TYPE_SCHOOL] = 0,
-        [TYPE_HIGH_SCHOOL] = 0,
-        [TYPE_UNIVERSITY] = 0,
-        [TYPE_MUSEUM] = 0,
-        [TYPE_LIBRARY] = 0,
-        [TYPE_AIRPORT] = 1, // The tiles below generate pollution, so it's
-        [TYPE_PORT] = 1,    // illogical to ask for no pollution there.
-        [TYPE_DOCK] = 1,
-        [TYPE_POWER_PLANT] = 1,
-        [TYPE_FIRE] = 0, // Simulation should be off during fires.
-        [TYPE_RADIATION] = 1, // Ignore pollution here
-    };
+    uint16_t type = City_Tileset_Entry_Info(tile)->element_type;
 
-    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    uint64_t bit = (uint64_t)1 << x;
+
+    if (type & TYPE_HAS_ROAD)
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        if ((pollution_road_tiles[y] & bit) == 0)
         {
-            uint16_t type = CityMapGetType(i, j) & TYPE_MASK;
+            pollution_road_tiles[y] |= bit;
+            pollution_changed_tiles[y] |= bit;
+        }
+    }
+    else
+    {
+        pollution_road_tiles[y] &= ~bit;
 
-            if (ignore_tile_array[type])
-            {
-                // This tile ignores pollution - Set "valid pollution level" bit
-                Simulation_HappinessSetFlags(i, j, TILE_OK_POLLUTION);
-            }
-            else
+        const city_tile_density_info *di = CityTileDensityInfo(tile);
+        if (pollution_sources[y * CITY_MAP_WIDTH + x] != di->pollution_level)
+            pollution_changed_tiles[y] |= bit;
+    }
+
+    uint64_t ignore = ignore_tile_array[type & TYPE_MASK] ? bit : 0;
+
+    if ((pollution_ignore_tiles[y] & bit) != ignore)
+    {
+        pollution_ignore_tiles[y] ^= bit;
+        pollution_changed_rows |= (uint64_t)1 << y;
+    }
+}
+
+IWRAM_CODE static void Simulation_PollutionSetTileOkFlag(uint64_t rows)
+{
+    uint64_t *plane = Simulation_HappinessGetPlane(TILE_OK_POLLUTION_BIT);
+
+    while (rows != 0)
+    {
+        int j = __builtin_ctzll(rows);
+        rows &= rows - 1;
+
+        // Tiles that ignore pollution always have the "valid pollution level"
+        // bit set. The rest require a level check...
+
+        uint64_t ok = pollution_ignore_tiles[j];
+
+        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        {
+            unsigned int pollution = scratch_map_1[j * CITY_MAP_WIDTH + i];
+            if (pollution <= POLLUTION_MAX_VALID_LEVEL)
             {
-                // Buildings require a level check...
-                unsigned int pollution = scratch_map_1[j * CITY_MAP_WIDTH + i];
-                if (pollution > POLLUTION_MAX_VALID_LEVEL)
-                {
-                    // Polluted
-                    Simulation_HappinessResetFlags(i, j, TILE_OK_POLLUTION);
-                }
-                else
-                {
-                    // Not polluted
-                    Simulation_HappinessSetFlags(i, j, TILE_OK_POLLUTION);
-                }
+                // Not polluted
+                ok |= (uint64_t)1 << i;
             }
         }
+
+        plane[j] = ok;
     }
 }
 
 IWRAM_CODE void Simulation_Pollution(void)
 {
-    // Cleanup
-    // -------
+    // Rows with sources of pollution that have changed since the last time
+    uint64_t dirty_rows = 0;
 
-    // It isn't needed to clean the second map, it is overwriten
-
-    memset(scratch_map_1, 0, sizeof(scratch_map_1));
-
-    pollution_total = 0;
-
-    // Add to the map the corresponding pollution for each tile
+    // Update the pollution of the tiles that may have changed
+    // -------------------------------------------------------
 
     uint8_t *traffic_map = Simulation_TrafficGetMap();
+    uint64_t *traffic_changed = Simulation_TrafficGetChangedPlane();
 
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        // Changes in the traffic only matter in roads. Train doesn't pollute
+        // as it is electric.
+
+        uint64_t changed = pollution_changed_tiles[j] |
+                           (traffic_changed[j] & pollution_road_tiles[j]);
+
+        pollution_changed_tiles[j] = 0;
+        traffic_changed[j] = 0;
+
+        while (changed != 0)
         {
+            int i = __builtin_ctzll(changed);
+            changed &= changed - 1;
+
             // Get tile type:
             //
-            // - If road, check traffic. Train doesn't pollute as it is
-            //   electric.
+            // - If road, check traffic.
             //
             // - If building, check if the building has power and add pollution
             //   if so. If it is a power plant, add the corresponding pollution
@@ -209,21 +363,54 @@ IWRAM_CODE void Simulation_Pollution(void)
                 value = di->pollution_level;
             }
 
-            scratch_map_1[j * CITY_MAP_WIDTH + i] = value;
+            uint8_t *source = &pollution_sources[j * CITY_MAP_WIDTH + i];
 
-            // Add to total pollution
+            if (*source != value)
+            {
+                // Update total pollution
+                pollution_total += value - *source;
 
-            pollution_total += value;
+                *source = value;
+                dirty_rows |= (uint64_t)1 << j;
+            }
         }
     }
 
     // Diffuminate map
-    // ----------
+    // ---------------
+
+    // The map is only updated around the sources that have changed. A change
+    // can only affect the rows that are DIFFUMINATE_ITERATIONS rows away from
+    // it or closer.
 
-    Diffuminate_Loop(&scratch_map_1[0], &scratch_map_2[0]);
-    Diffuminate_Loop(&scratch_map_2[0], &scratch_map_1[0]);
-    Diffuminate_Loop(&scratch_map_1[0], &scratch_map_2[0]);
-    Diffuminate_Loop(&scratch_map_2[0], &scratch_map_1[0]);
+    uint64_t affected_rows = dirty_rows;
+
+    for (int k = 1; k <= DIFFUMINATE_ITERATIONS; k++)
+        affected_rows |= (dirty_rows << k) | (dirty_rows >> k);
+
+    // Only the rows with a different level of pollution or with different
+    // tiles that ignore pollution need to have their flags updated.
+
+    uint64_t flag_rows = affected_rows | pollution_changed_rows;
+    pollution_changed_rows = 0;
+
+    while (affected_rows != 0)
+    {
+        int first = __builtin_ctzll(affected_rows);
+
+        // Find the end of this group of consecutive rows
+        uint64_t group = affected_rows + ((uint64_t)1 << first);
+        int last = (group == 0) ? (CITY_MAP_HEIGHT - 1)
+                                : (__builtin_ctzll(group) - 1);
+
+        Diffuminate_Rows(&pollution_sources[0], &scratch_map_1[0],
+                         first, last);
+
+        if (last == CITY_MAP_HEIGHT - 1)
+            break;
+
+        affected_rows &= ~(((uint64_t)2 << last) - 1);
+    }
 
     // Check if pollution is too high
     // ------------------------------
@@ -245,5 +432,5 @@ IWRAM_CODE void Simulation_Pollution(void)
     // Set flags
     // ---------
 
-    Simulation_PollutionSetTileOkFlag();
+    Simulation_PollutionSetTileOkFlag(flag_rows);
 }
@@ -14,4 +14,10 @@ int Simulation_PollutionGetPercentage(void);
 
 void Simulation_Pollution(void);
 
+// Rebuild the information about sources of pollution from the map
+void PollutionSourcesRefresh(void);
+// Update the information about sources of pollution after drawing the specified
+// tile
+void PollutionSourcesUpdate(int x, int y, uint16_t tile);
+
 #endif // SIMULATION_POLLUTION_H__
@@ -8,41 +8,60 @@
 #include <ugba/ugba.h>
 
 #include "date.h"
-#include "room_game/building_info.h"
 #include "room_game/draw_common.h"
 #include "room_game/draw_power_lines.h"
 #include "room_game/room_game.h"
 #include "room_game/tileset_info.h"
 #include "simulation/building_density.h"
-#include "simulation/queue.h"
+#include "simulation/building_registry.h"
+#include "simulation/epoch_grid.h"
 #include "simulation/happiness.h"
+#include "simulation/queue.h"
 
-#define TILE_HANDLED_BIT                7
 #define TILE_HANDLED_POWER_PLANT_BIT    6
 
-#define TILE_HANDLED                    (1 << TILE_HANDLED_BIT)
 #define TILE_HANDLED_POWER_PLANT        (1 << TILE_HANDLED_POWER_PLANT_BIT)
 // How much power there is now
 #define TILE_POWER_LEVEL_MASK           (0x3F)
 
 EWRAM_BSS static uint8_t power_map[CITY_MAP_HEIGHT * CITY_MAP_WIDTH];
 
+// Tiles that have been added to the queue of the flood fill of the component
+// being handled at the moment. A new epoch is started for each flood fill.
+EWRAM_BSS static uint8_t power_stamps[CITY_MAP_HEIGHT * CITY_MAP_WIDTH];
+static epoch_grid power_handled = EPOCH_GRID_INITIALIZER(power_stamps);
+
 uint8_t *Simulation_PowerDistributionGetMap(void)
 {
     return &power_map[0];
 }
 
+// The queue holds indices of tiles. Tiles are flagged in power_handled when
+// they are added to the queue, so each tile is added at most once per flood
+// fill, and the queue can't need more elements than tiles in the map. If it
+// overflows anyway, the rest of the tiles are dropped and the overflow is
+// reported by QueueHasOverflowed().
+#define POWER_QUEUE_SIZE        (CITY_MAP_HEIGHT * CITY_MAP_WIDTH)
+
+EWRAM_BSS static uint16_t power_queue_buffer[POWER_QUEUE_SIZE];
+static queue power_queue = QUEUE_INITIALIZER(power_queue_buffer);
+
+const queue *Simulation_PowerDistributionGetQueue(void)
+{
+    return &power_queue;
+}
+
 static int power_plant_energy_left;
 
+// Bitplane of the TILE_OK_POWER flag
+static uint64_t *power_ok_plane;
+
 // Give as much energy as possible to the specified tile
 IWRAM_CODE static void AddPowerToTile(int x, int y)
 {
-    // If this is a power plant, flag as handled and return right away
+    // If this is a power plant, return right away
     if (power_map[y * CITY_MAP_WIDTH + x] & TILE_HANDLED_POWER_PLANT)
-    {
-        power_map[y * CITY_MAP_WIDTH + x] |= TILE_HANDLED;
         return;
-    }
 
     // If not, give power
 
@@ -65,14 +84,23 @@ IWRAM_CODE static void AddPowerToTile(int x, int y)
     else
     {
         consumed_energy = needed_energy;
-        Simulation_HappinessSetFlags(x, y, TILE_OK_POWER);
+        power_ok_plane[y] |= (uint64_t)1 << x;
     }
 
     power_plant_energy_left -= consumed_energy;
 
     // Add to tile energy
 
-    *ptr = ((*ptr + consumed_energy) & TILE_POWER_LEVEL_MASK) | TILE_HANDLED;
+    *ptr = (*ptr + consumed_energy) & TILE_POWER_LEVEL_MASK;
+}
+
+// Add a tile to the queue and flag it as handled
+IWRAM_CODE static void AddToQueue(int x, int y)
+{
+    int index = y * CITY_MAP_WIDTH + x;
+
+    EPOCH_GRID_TOUCH(&power_handled, index);
+    QueueAdd(&power_queue, index);
 }
 
 IWRAM_CODE static void AddToQueueHorizontalDisplacement(int x, int y)
@@ -80,8 +108,8 @@ IWRAM_CODE static void AddToQueueHorizontalDisplacement(int x, int y)
     if ((x < 0) || (x >= CITY_MAP_WIDTH))
         return;
 
-    // Check if already handled
-    if (power_map[y * CITY_MAP_WIDTH + x] & TILE_HANDLED)
+    // Check if already added to the queue
+    if (EPOCH_GRID_IS_CURRENT(&power_handled, y * CITY_MAP_WIDTH + x))
         return;
 
     uint16_t tile, type;
@@ -98,7 +126,7 @@ IWRAM_CODE static void AddToQueueHorizontalDisplacement(int x, int y)
         return;
 
     // Add to queue!
-    QueueAddPair(x, y);
+    AddToQueue(x, y);
 }
 
 IWRAM_CODE static void AddToQueueVerticalDisplacement(int x, int y)
@@ -106,8 +134,8 @@ IWRAM_CODE static void AddToQueueVerticalDisplacement(int x, int y)
     if ((y < 0) || (y >= CITY_MAP_HEIGHT))
         return;
 
-    // Check if already handled
-    if (power_map[y * CITY_MAP_WIDTH + x] & TILE_HANDLED)
+    // Check if already added to the queue
+    if (EPOCH_GRID_IS_CURRENT(&power_handled, y * CITY_MAP_WIDTH + x))
         return;
 
     uint16_t tile, type;
@@ -124,72 +152,476 @@ IWRAM_CODE static void AddToQueueVerticalDisplacement(int x, int y)
         return;
 
     // Add to queue!
-    QueueAddPair(x, y);
+    AddToQueue(x, y);
+}
+
+// Union-find forest of the tiles that transmit power. Each tile points to its
+// parent, and the root of each component points to itself. The root is always
+// the tile of the component with the lowest index.
+EWRAM_BSS static uint16_t power_parent[CITY_MAP_HEIGHT * CITY_MAP_WIDTH];
+
+// Only the components with power plants need to know how much energy they
+// have. They are numbered in the raster order of their roots. Power plants are
+// 2x2 tiles at least, so there can't be more components with power plants than
+// this.
+#define POWER_MAX_PLANT_COMPONENTS  ((CITY_MAP_HEIGHT * CITY_MAP_WIDTH) / 4)
+
+// Bitplane of the roots of the components with power plants
+EWRAM_BSS static uint64_t power_plant_roots[CITY_MAP_HEIGHT];
+
+// Number of roots of components with power plants in the rows above each row
+EWRAM_BSS static uint16_t power_plant_roots_above[CITY_MAP_HEIGHT];
+
+static int power_num_plant_components;
+
+// Energy needed by all the tiles of each component with power plants
+EWRAM_BSS static int32_t power_demand[POWER_MAX_PLANT_COMPONENTS];
+
+// Energy of the power plants of each component with power plants minus the
+// energy needed by all the tiles of it
+EWRAM_BSS static int32_t power_balance[POWER_MAX_PLANT_COMPONENTS];
+
+// Bitplane of the roots of the components without power plants that need some
+// energy. The rest of components without power plants don't need any energy.
+EWRAM_BSS static uint64_t power_needs_energy[CITY_MAP_HEIGHT];
+
+// Bitplane of the tiles that transmit power
+EWRAM_BSS static uint64_t power_transmits[CITY_MAP_HEIGHT];
+
+// The components, power map and TILE_OK_POWER flags are kept between calls to
+// Simulation_PowerDistribution(). Only the components that contain modified
+// tiles (or are next to them), and the ones whose power plants don't have
+// enough energy anymore, are filled again.
+
+// Bitplane of the tiles modified since the last time
+EWRAM_BSS static uint64_t power_dirty[CITY_MAP_HEIGHT];
+static int power_grid_dirty;
+
+// 0 if all the cached state has to be discarded
+static int power_grid_valid;
+
+// Month of the last time the power grid was filled
+static int power_grid_month;
+
+// Bitplane of the roots of the components that had enough energy
+EWRAM_BSS static uint64_t power_full[CITY_MAP_HEIGHT];
+
+// Bitplane of the roots of the components that have to be filled again
+EWRAM_BSS static uint64_t power_refill[CITY_MAP_HEIGHT];
+
+IWRAM_CODE static int PowerFindRoot(int index)
+{
+    while (power_parent[index] != index)
+    {
+        // Path halving
+        power_parent[index] = power_parent[power_parent[index]];
+        index = power_parent[index];
+    }
+
+    return index;
+}
+
+IWRAM_CODE static void PowerJoin(int a, int b)
+{
+    a = PowerFindRoot(a);
+    b = PowerFindRoot(b);
+
+    if (a < b)
+        power_parent[b] = a;
+    else if (b < a)
+        power_parent[a] = b;
+}
+
+// Returns the index of the component with power plants with the specified root,
+// or -1 if the component doesn't have any power plant.
+IWRAM_CODE static int PowerPlantComponentGet(int root)
+{
+    int x = root % CITY_MAP_WIDTH;
+    int y = root / CITY_MAP_WIDTH;
+
+    uint64_t row = power_plant_roots[y];
+
+    if (((row >> x) & 1) == 0)
+        return -1;
+
+    uint64_t left = row & (((uint64_t)1 << x) - 1);
+
+    return power_plant_roots_above[y] + __builtin_popcountll(left);
 }
 
-// Flood fill from the power plant on the specified coordinates. It also needs
-// the delta to reach the center of the power plant.
-IWRAM_CODE static void Simulation_PowerPlantFloodFill(uint16_t base_tile,
-                                                      int x, int y,
-                                                      int dx, int dy, int power)
+// Returns the energy left in the component with the specified root after giving
+// energy to all its tiles. For components without power plants it only returns
+// 0 if they don't need energy, or -1 if they need it.
+IWRAM_CODE static int32_t PowerGetBalance(int root)
 {
-    // Reset all TILE_HANDLED flags
+    int n = PowerPlantComponentGet(root);
+    if (n >= 0)
+        return power_balance[n];
+
+    int x = root % CITY_MAP_WIDTH;
+    int y = root / CITY_MAP_WIDTH;
+
+    if ((power_needs_energy[y] >> x) & 1)
+        return -1;
 
-    for (int i = 0; i < CITY_MAP_HEIGHT * CITY_MAP_WIDTH; i++)
-        power_map[i] &= ~TILE_HANDLED;
+    return 0;
+}
 
-    // Flag power plant as handled
+// Returns the power generated this month by the power plant with the specified
+// top left tile, or -1 if it isn't a power plant. It also returns the delta
+// from the top left tile to the center of the power plant.
+IWRAM_CODE static int PowerPlantGetPower(uint16_t tile, int month,
+                                         int *dx, int *dy)
+{
+    // All power plants have fluctuations in power during the year:
+    //
+    // 1. Solar plants output more power in summer, wind plants in winter.
     //
-    // This is faster than setting the power of all other tiles of the central
-    // to have power 0 because the TILE_HANDLED flag doesn't have to be cleared
-    // this way.
+    // 2. The others depend on thermodynamic cycles, which are more efficient
+    //    in winter, when the external temperature is lower.
 
-    const building_info *info = Get_BuildingFromBaseTile(base_tile);
+    *dx = 1;
+    *dy = 1;
 
-    for (int j = y; j < (y + info->height); j++)
+    switch (tile)
     {
-        for (int i = x; i < (x + info->width); i++)
-            power_map[j * CITY_MAP_WIDTH + i] |= TILE_HANDLED_POWER_PLANT;
+        case T_POWER_PLANT_COAL:
+        {
+            const int power[12] = {
+                3000, 2950, 2900, 2850, 2800, 2750, // Jan - Jun
+                2750, 2800, 2850, 2900, 2950, 3000  // Jul - Dec
+            };
+            return power[month];
+        }
+        case T_POWER_PLANT_OIL:
+        {
+            const int power[12] = {
+                2000, 1950, 1900, 1850, 1800, 1750, // Jan - Jun
+                1750, 1800, 1850, 1900, 1950, 2000 // Jul - Dec
+            };
+            return power[month];
+        }
+        case T_POWER_PLANT_WIND:
+        {
+            const int power[12] = {
+                200, 180, 160, 140, 120, 100, // Jan - Jun
+                100, 120, 140, 160, 180, 200  // Jul - Dec
+            };
+            *dx = 0;
+            *dy = 0;
+            return power[month];
+        }
+        case T_POWER_PLANT_SOLAR:
+        {
+            const int power[12] = {
+                1000, 1200, 1400, 1600, 1800, 2000, // Jan - Jun
+                2000, 1800, 1600, 1400, 1200, 1000  // Jul - Dec
+            };
+            return power[month];
+        }
+        case T_POWER_PLANT_NUCLEAR:
+        {
+            const int power[12] = {
+                5000, 4950, 4900, 4850, 4800, 4750, // Jan - Jun
+                4750, 4800, 4850, 4900, 4950, 5000  // Jul - Dec
+            };
+            return power[month];
+        }
+        case T_POWER_PLANT_FUSION:
+        {
+            const int power[12] = {
+                10000, 9500, 9000, 8500, 8000, 7500, // Jan - Jun
+                7500, 8000, 8500, 9000, 9500, 10000  // Jul - Dec
+            };
+            return power[month];
+        }
+        default:
+            return -1;
     }
+}
 
-    power_plant_energy_left = power;
+// Join all tiles that transmit power into connected components, and save the
+// energy that all the tiles of each component need.
+IWRAM_CODE static void PowerBuildComponents(int month)
+{
+    uint64_t transmits_above = 0;
 
-    // Flood fill
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        uint64_t transmits = 0;
+
+        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        {
+            int index = j * CITY_MAP_WIDTH + i;
+
+            power_parent[index] = index;
+
+            uint16_t tile, type;
+            CityMapGetTypeAndTileUnsafe(i, j, &tile, &type);
+
+            if ((TypeHasElectricityExtended(type) & TYPE_HAS_POWER) == 0)
+                continue;
+
+            transmits |= (uint64_t)1 << i;
+
+            // Vertical bridges are only connected to the top and bottom, and
+            // horizontal bridges to the left and right.
+
+            if ((i > 0) && (transmits & ((uint64_t)1 << (i - 1))))
+            {
+                if ((tile != T_POWER_LINES_TB_BRIDGE) &&
+                    (CityMapGetTile(i - 1, j) != T_POWER_LINES_TB_BRIDGE))
+                {
+                    PowerJoin(index, index - 1);
+                }
+            }
+
+            if (transmits_above & ((uint64_t)1 << i))
+            {
+                if ((tile != T_POWER_LINES_LR_BRIDGE) &&
+                    (CityMapGetTile(i, j - 1) != T_POWER_LINES_LR_BRIDGE))
+                {
+                    PowerJoin(index, index - CITY_MAP_WIDTH);
+                }
+            }
+        }
+
+        power_transmits[j] = transmits;
+        transmits_above = transmits;
+    }
+
+    // Find the components with power plants and number them
+
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        power_plant_roots[j] = 0;
+        power_needs_energy[j] = 0;
+    }
+
+    building_registry_iterator it;
+    building_registry_entry b;
+
+    BuildingRegistryIteratorStart(&it);
+
+    while (BuildingRegistryIteratorNext(&it, &b))
+    {
+        int dx, dy;
+        if (PowerPlantGetPower(b.tile, month, &dx, &dy) < 0)
+            continue;
+
+        int root = PowerFindRoot((b.y + dy) * CITY_MAP_WIDTH + b.x + dx);
+
+        power_plant_roots[root / CITY_MAP_WIDTH] |=
+                (uint64_t)1 << (root % CITY_MAP_WIDTH);
+    }
+
+    int num = 0;
+
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        power_plant_roots_above[j] = num;
+        num += __builtin_popcountll(power_plant_roots[j]);
+    }
+
+    UGBA_Assert(num <= POWER_MAX_PLANT_COMPONENTS);
+
+    power_num_plant_components = num;
+
+    for (int n = 0; n < num; n++)
+        power_demand[n] = 0;
+
+    // Add the energy needed by each tile to its component. Power plants don't
+    // need energy.
+
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        uint64_t transmits = power_transmits[j];
+
+        while (transmits != 0)
+        {
+            int i = __builtin_ctzll(transmits);
+            transmits &= transmits - 1;
+
+            int index = j * CITY_MAP_WIDTH + i;
+
+            if (power_map[index] & TILE_HANDLED_POWER_PLANT)
+                continue;
+
+            uint16_t tile = CityMapGetTile(i, j);
+            const city_tile_density_info *info = CityTileDensityInfo(tile);
+
+            if (info->energy_cost == 0)
+                continue;
+
+            int root = PowerFindRoot(index);
+            int n = PowerPlantComponentGet(root);
+
+            if (n >= 0)
+            {
+                power_demand[n] += info->energy_cost;
+            }
+            else
+            {
+                power_needs_energy[root / CITY_MAP_WIDTH] |=
+                        (uint64_t)1 << (root % CITY_MAP_WIDTH);
+            }
+        }
+    }
+}
+
+IWRAM_CODE static void PowerRefillSet(int index)
+{
+    power_refill[index / CITY_MAP_WIDTH] |=
+            (uint64_t)1 << (index % CITY_MAP_WIDTH);
+}
+
+IWRAM_CODE static int PowerRefillGet(int index)
+{
+    return (power_refill[index / CITY_MAP_WIDTH] >>
+            (index % CITY_MAP_WIDTH)) & 1;
+}
+
+// Flag the components of a modified tile and its neighbours to be refilled. If
+// the modified tile doesn't transmit power anymore, its own component has been
+// split into components that contain one of the neighbours at least.
+IWRAM_CODE static void PowerRefillAround(int x, int y)
+{
+    int index = y * CITY_MAP_WIDTH + x;
+
+    PowerRefillSet(PowerFindRoot(index));
+
+    if (x > 0)
+        PowerRefillSet(PowerFindRoot(index - 1));
+    if (x < (CITY_MAP_WIDTH - 1))
+        PowerRefillSet(PowerFindRoot(index + 1));
+    if (y > 0)
+        PowerRefillSet(PowerFindRoot(index - CITY_MAP_WIDTH));
+    if (y < (CITY_MAP_HEIGHT - 1))
+        PowerRefillSet(PowerFindRoot(index + CITY_MAP_WIDTH));
+}
+
+// Clear the components flagged to be refilled, and give all the energy they
+// need to all tiles of the ones with enough energy.
+IWRAM_CODE static void PowerFillComponents(void)
+{
+    // Consecutive tiles usually belong to the same component
+    int last_root = -1;
+    int32_t balance = 0;
+
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        {
+            if ((power_transmits[j] & ((uint64_t)1 << i)) == 0)
+                continue;
+
+            int index = j * CITY_MAP_WIDTH + i;
+            int root = PowerFindRoot(index);
+
+            if (!PowerRefillGet(root))
+                continue;
 
-    // For each connected tile with scratch RAM value of 0 reduce the fill
-    // amount of the power plant by the energy consumption of that tile (if
-    // possible) and add the energy given to that tile to the scratch RAM. Power
-    // lines have energetic cost.
+            if (root != last_root)
+            {
+                balance = PowerGetBalance(root);
+                last_root = root;
+            }
+
+            // Remember if the component had enough energy so that it can be
+            // skipped next month if it still has enough energy.
+            if (root == index)
+            {
+                if (balance >= 0)
+                    power_full[j] |= (uint64_t)1 << i;
+                else
+                    power_full[j] &= ~((uint64_t)1 << i);
+            }
+
+            if (power_map[index] & TILE_HANDLED_POWER_PLANT)
+                continue;
+
+            power_map[index] = 0;
+            power_ok_plane[j] &= ~((uint64_t)1 << i);
+
+            if (balance < 0)
+                continue;
+
+            uint16_t tile = CityMapGetTile(i, j);
+            const city_tile_density_info *info = CityTileDensityInfo(tile);
+
+            power_map[index] = info->energy_cost & TILE_POWER_LEVEL_MASK;
+            power_ok_plane[j] |= (uint64_t)1 << i;
+        }
+    }
+}
+
+// Flood fill from all the power plants of the component with the specified
+// root, starting the search of power plants at the position of the building
+// registry iterator `first`. It is used for components without enough energy
+// for all the tiles, so that the tiles closest to the power plants get energy
+// first.
+IWRAM_CODE static void PowerFloodFillComponent(int root,
+                                               building_registry_iterator first,
+                                               int month)
+{
+    building_registry_iterator it = first;
+    building_registry_entry b;
+
+    // Flag all tiles as not handled
+
+    EpochGridNewEpoch(&power_handled);
 
-    QueueInit();
+    power_plant_energy_left = 0;
 
-    QueueAddPair(x + dx, y + dy); // Add first element
+    QueueInit(&power_queue);
+
+    // Add the central tile of all power plants of the component in raster
+    // order, and add their energy.
+
+    while (BuildingRegistryIteratorNext(&it, &b))
+    {
+        int dx, dy;
+        int power = PowerPlantGetPower(b.tile, month, &dx, &dy);
+        if (power < 0)
+            continue;
+
+        if (PowerFindRoot((b.y + dy) * CITY_MAP_WIDTH + b.x + dx) != root)
+            continue;
+
+        power_plant_energy_left += power;
+
+        AddToQueue(b.x + dx, b.y + dy);
+    }
+
+    // Flood fill
+
+    // For each connected tile that hasn't been handled reduce the energy left
+    // by the energy consumption of that tile (if possible) and add the energy
+    // given to that tile to the power map. Power lines have energetic cost.
 
     while (1)
     {
-        // Check remaining power plant energy. If 0, exit loop.
+        // Check remaining energy. If 0, exit loop.
         if (power_plant_energy_left == 0)
             break;
 
         // Check if queue is empty. If so, exit loop
-        if (QueueIsEmpty())
+        if (QueueIsEmpty(&power_queue))
             break;
 
         // 1) Get Queue element.
 
-        uint16_t ex, ey;
-        QueueGetPair(&ex, &ey);
+        uint16_t index = QueueGet(&power_queue);
+        int ex = index % CITY_MAP_WIDTH;
+        int ey = index / CITY_MAP_WIDTH;
 
-        // 2) If not already handled by this plant, try to fill current
-        //    coordinates.
+        // 2) Try to fill current coordinates. Tiles are only added to the
+        //    queue once, so it can't have been handled before.
 
-        if (power_map[ey * CITY_MAP_WIDTH + ex] & TILE_HANDLED)
-            continue; // Already handled by this power plant, ignore
-
-        // Not handled. Get energy consumption of the tile and give as much
-        // energy as needed. If there is not enough energy left for that, give
-        // as much as possible, flag as handled and exit loop next iteration (at
-        // the check at the top of the loop).
+        // Get energy consumption of the tile and give as much energy as
+        // needed. If there is not enough energy left for that, give as much as
+        // possible and exit loop next iteration (at the check at the top of the
+        // loop).
 
         AddPowerToTile(ex, ey);
 
@@ -216,159 +648,266 @@ IWRAM_CODE static void Simulation_PowerPlantFloodFill(uint16_t base_tile,
     }
 }
 
+IWRAM_CODE void PowerGridUpdate(int x, int y, uint16_t tile)
+{
+    if (CityMapGetTile(x, y) == tile)
+        return;
+
+    // The type matrix still has the type of the previous tile
+
+    uint16_t old_type = CityMapGetTypeNoBoundCheck(x, y);
+    uint16_t new_type = City_Tileset_Entry_Info(tile)->element_type;
+
+    if (((TypeHasElectricityExtended(old_type) |
+          TypeHasElectricityExtended(new_type)) & TYPE_HAS_POWER) == 0)
+        return;
+
+    power_dirty[y] |= (uint64_t)1 << x;
+    power_grid_dirty = 1;
+}
+
+void PowerGridRefresh(void)
+{
+    power_grid_valid = 0;
+}
+
 IWRAM_CODE void Simulation_PowerDistribution(void)
 {
-    memset(power_map, 0, sizeof(power_map));
+    power_ok_plane = Simulation_HappinessGetPlane(TILE_OK_POWER_BIT);
+
+    int month = DateGetMonth();
+
+    building_registry_iterator it;
+    building_registry_entry b;
+
+    // If the cached state can't be trusted, start from scratch
+
+    if (!power_grid_valid)
+    {
+        memset(power_map, 0, sizeof(power_map));
+
+        for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+            power_ok_plane[j] = 0;
+    }
+
+    // Modified tiles may not transmit power anymore, so they wouldn't be
+    // cleared when their components are refilled.
 
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
-            Simulation_HappinessResetFlags(i, j, TILE_OK_POWER);
+        uint64_t dirty = power_dirty[j];
+
+        while (dirty != 0)
+        {
+            int i = __builtin_ctzll(dirty);
+            dirty &= dirty - 1;
+
+            power_map[j * CITY_MAP_WIDTH + i] = 0;
+            power_ok_plane[j] &= ~((uint64_t)1 << i);
+        }
     }
 
-    int month = DateGetMonth();
+    // Flag the tiles of all power plants. They transmit power, but they don't
+    // need it.
+
+    BuildingRegistryIteratorStart(&it);
+
+    while (BuildingRegistryIteratorNext(&it, &b))
+    {
+        int dx, dy;
+        if (PowerPlantGetPower(b.tile, month, &dx, &dy) < 0)
+            continue;
+
+        int width, height;
+        BuildingRegistryGetSize(&b, &width, &height);
+
+        for (int j = b.y; j < (b.y + height); j++)
+        {
+            for (int i = b.x; i < (b.x + width); i++)
+                power_map[j * CITY_MAP_WIDTH + i] |= TILE_HANDLED_POWER_PLANT;
+        }
+    }
+
+    // Find all connected components and the energy they need. They only change
+    // when a tile that transmits power is modified.
+
+    if (power_grid_dirty || !power_grid_valid)
+        PowerBuildComponents(month);
+
+    // Add the energy of all power plants of this month to their components.
+    // Power plants are handled in raster order.
+
+    for (int n = 0; n < power_num_plant_components; n++)
+        power_balance[n] = -power_demand[n];
+
+    BuildingRegistryIteratorStart(&it);
+
+    while (BuildingRegistryIteratorNext(&it, &b))
+    {
+        int dx, dy;
+        int power = PowerPlantGetPower(b.tile, month, &dx, &dy);
+        if (power < 0)
+            continue;
+
+        int root = PowerFindRoot((b.y + dy) * CITY_MAP_WIDTH + b.x + dx);
+        power_balance[PowerPlantComponentGet(root)] += power;
+    }
+
+    // Flag the components whose energy may have changed since the last time.
+    // The rest of components keep the same state.
+
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+        power_refill[j] = power_grid_valid ? 0 : UINT64_MAX;
 
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        uint64_t dirty = power_dirty[j];
+
+        while (dirty != 0)
         {
-            uint16_t tile = CityMapGetTile(i, j);
+            int i = __builtin_ctzll(dirty);
+            dirty &= dirty - 1;
 
-            // All power plants have fluctuations in power during the year:
-            //
-            // 1. Solar plants output more power in summer, wind plants in
-            //    winter.
-            //
-            // 2. The others depend on thermodynamic cycles, which are more
-            //    efficient in winter, when the external temperature is lower.
+            PowerRefillAround(i, j);
+        }
+    }
 
-            switch (tile)
-            {
-                case T_POWER_PLANT_COAL:
-                {
-                    const int power[12] = {
-                        3000, 2950, 2900, 2850, 2800, 2750, // Jan - Jun
-                        2750, 2800, 2850, 2900, 2950, 3000  // Jul - Dec
-                    };
-                    Simulation_PowerPlantFloodFill(T_POWER_PLANT_COAL, i, j,
-                                                   1, 1, power[month]);
-                    break;
-                }
-                case T_POWER_PLANT_OIL:
-                {
-                    const int power[12] = {
-                        2000, 1950, 1900, 1850, 1800, 1750, // Jan - Jun
-                        1750, 1800, 1850, 1900, 1950, 2000 // Jul - Dec
-                    };
-                    Simulation_PowerPlantFloodFill(T_POWER_PLANT_OIL, i, j,
-                                                   1, 1, power[month]);
-                    break;
-                }
-                case T_POWER_PLANT_WIND:
-                {
-                    const int power[12] = {
-                        200, 180, 160, 140, 120, 100, // Jan - Jun
-                        100, 120, 140, 160, 180, 200  // Jul - Dec
-                    };
-                    Simulation_PowerPlantFloodFill(T_POWER_PLANT_WIND, i, j,
-                                                   0, 0, power[month]);
-                    break;
-                }
-                case T_POWER_PLANT_SOLAR:
-                {
-                    const int power[12] = {
-                        1000, 1200, 1400, 1600, 1800, 2000, // Jan - Jun
-                        2000, 1800, 1600, 1400, 1200, 1000  // Jul - Dec
-                    };
-                    Simulation_PowerPlantFloodFill(T_POWER_PLANT_SOLAR, i, j,
-                                                   1, 1, power[month]);
-                    break;
-                }
-                case T_POWER_PLANT_NUCLEAR:
-                {
-                    const int power[12] = {
-                        5000, 4950, 4900, 4850, 4800, 4750, // Jan - Jun
-                        4750, 4800, 4850, 4900, 4950, 5000  // Jul - Dec
-                    };
-                    Simulation_PowerPlantFloodFill(T_POWER_PLANT_NUCLEAR, i, j,
-                                                   1, 1, power[month]);
-                    break;
-                }
-                case T_POWER_PLANT_FUSION:
-                {
-                    const int power[12] = {
-                        10000, 9500, 9000, 8500, 8000, 7500, // Jan - Jun
-                        7500, 8000, 8500, 9000, 9500, 10000  // Jul - Dec
-                    };
-                    Simulation_PowerPlantFloodFill(T_POWER_PLANT_FUSION, i, j,
-                                                   1, 1, power[month]);
-                    break;
-                }
-                default:
-                    break;
-            }
+    BuildingRegistryIteratorStart(&it);
+
+    while (BuildingRegistryIteratorNext(&it, &b))
+    {
+        int dx, dy;
+        if (PowerPlantGetPower(b.tile, month, &dx, &dy) < 0)
+            continue;
+
+        int root = PowerFindRoot((b.y + dy) * CITY_MAP_WIDTH + b.x + dx);
+
+        // If the component had enough energy and it still has enough energy,
+        // nothing changes. If the energy isn't enough, the flood fill depends
+        // on the output of the power plants, which depends on the month.
+
+        int was_full = (power_full[root / CITY_MAP_WIDTH] >>
+                        (root % CITY_MAP_WIDTH)) & 1;
+
+        if (PowerGetBalance(root) >= 0)
+        {
+            if (!was_full)
+                PowerRefillSet(root);
+        }
+        else
+        {
+            if (was_full || (month != power_grid_month))
+                PowerRefillSet(root);
         }
     }
 
+    // Components with enough energy get all the energy they need
+
+    PowerFillComponents();
+
+    // The energy of the rest of the components is given to the tiles closest
+    // to the power plants first.
+
+    BuildingRegistryIteratorStart(&it);
+
+    while (1)
+    {
+        // Position of the iterator before reading this building
+        building_registry_iterator first = it;
+
+        if (!BuildingRegistryIteratorNext(&it, &b))
+            break;
+
+        int dx, dy;
+        if (PowerPlantGetPower(b.tile, month, &dx, &dy) < 0)
+            continue;
+
+        int root = PowerFindRoot((b.y + dy) * CITY_MAP_WIDTH + b.x + dx);
+
+        if (!PowerRefillGet(root))
+            continue;
+
+        int n = PowerPlantComponentGet(root);
+
+        if (power_balance[n] >= 0)
+            continue;
+
+        PowerFloodFillComponent(root, first, month);
+
+        // Flag the component as handled
+        power_balance[n] = 0;
+    }
+
     // Reset all remaining flags
 
-    for (int i = 0; i < CITY_MAP_HEIGHT * CITY_MAP_WIDTH; i++)
-        power_map[i] &= TILE_POWER_LEVEL_MASK;
+    BuildingRegistryIteratorStart(&it);
+
+    while (BuildingRegistryIteratorNext(&it, &b))
+    {
+        int dx, dy;
+        if (PowerPlantGetPower(b.tile, month, &dx, &dy) < 0)
+            continue;
+
+        int width, height;
+        BuildingRegistryGetSize(&b, &width, &height);
+
+        for (int j = b.y; j < (b.y + height); j++)
+        {
+            for (int i = b.x; i < (b.x + width); i++)
+                power_map[j * CITY_MAP_WIDTH + i] &= TILE_POWER_LEVEL_MASK;
+        }
+    }
 
     // Checks all tiles of this building and flags them as "not powered" unless
-    // all of them are powered.
+    // all of them are powered. All the tiles of a building belong to the same
+    // component, so only the buildings of refilled components can change.
 
-    uint8_t *happiness_map = Simulation_HappinessGetMap();
+    BuildingRegistryIteratorStart(&it);
 
-    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    while (BuildingRegistryIteratorNext(&it, &b))
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; )
-        {
-            uint16_t tile, type;
-            CityMapGetTypeAndTileUnsafe(i, j, &tile, &type);
+        // If this isn't a powered building, skip it
+        if ((TypeHasElectricityExtended(b.type) & TYPE_HAS_POWER) == 0)
+            continue;
 
-            // If this isn't a powered tile, skip it
-            if ((TypeHasElectricityExtended(type) & TYPE_HAS_POWER) == 0)
-            {
-                i++;
-                continue;
-            }
+        if (!PowerRefillGet(PowerFindRoot(b.y * CITY_MAP_WIDTH + b.x)))
+            continue;
 
-            // Only check top left corner of each building
-            if (BuildingIsCoordinateOrigin(tile) == 0)
-            {
-                i++;
-                continue;
-            }
+        int width, height;
+        BuildingRegistryGetSize(&b, &width, &height);
 
-            const building_info *info = Get_BuildingFromBaseTile(tile);
+        // Mask with the columns covered by the building
+        uint64_t mask = (((uint64_t)1 << width) - 1) << b.x;
 
-            int total = info->height * info->width;
-            int count = 0;
+        int any_powered = 0;
+        int all_powered = 1;
 
-            for (int y = j; y < (j + info->height); y++)
-            {
-                for (int x = i; x < (i + info->width); x++)
-                {
-                    if (happiness_map[y * CITY_MAP_WIDTH + x] & TILE_OK_POWER)
-                        count++;
-                }
-            }
+        for (int y = b.y; y < (b.y + height); y++)
+        {
+            uint64_t powered = power_ok_plane[y] & mask;
 
-            if ((count > 0) && (count < total))
-            {
-                // If any of the tiles is powered, but not all of them are,
-                // reset them all.
+            if (powered != 0)
+                any_powered = 1;
+            if (powered != mask)
+                all_powered = 0;
+        }
 
-                for (int y = j; y < (j + info->height); y++)
-                {
-                    for (int x = i; x < (i + info->width); x++)
-                        happiness_map[y * CITY_MAP_WIDTH + x] &= ~TILE_OK_POWER;
-                }
-            }
+        if (any_powered && !all_powered)
+        {
+            // If any of the tiles is powered, but not all of them are, reset
+            // them all.
 
-            // Skip rest of the width of this building
-            i += info->width;
+            for (int y = b.y; y < (b.y + height); y++)
+                power_ok_plane[y] &= ~mask;
         }
     }
+
+    // The cached state is now up to date
+
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+        power_dirty[j] = 0;
+
+    power_grid_dirty = 0;
+    power_grid_valid = 1;
+    power_grid_month = month;
 }
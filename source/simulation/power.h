@@ -7,10 +7,23 @@
 
 #include <stdint.h>
 
+#include "simulation/queue.h"
+
 uint8_t *Simulation_PowerDistributionGetMap(void);
 
-// Make sure to call Simulation_HappinessResetMap() before this one, or the
-// happiness flags will be saved on top of the previous state.
+// Statistics of the queue used by the flood fill
+const queue *Simulation_PowerDistributionGetQueue(void);
+
+// Flag a tile of the map as modified so that its power grid is filled again
+// in the next simulation step. It must be called before the tile is written to
+// the map and the type matrix.
+void PowerGridUpdate(int x, int y, uint16_t tile);
+// Discard the state of the power grid after loading a new map
+void PowerGridRefresh(void);
+
+// The TILE_OK_POWER flags and the power map are kept between calls, and only
+// the power grids that may have changed since the last call are updated. The
+// TILE_OK_POWER flags must not be modified anywhere else.
 void Simulation_PowerDistribution(void);
 
 #endif // SIMULATION_POWER_H__
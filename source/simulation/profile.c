@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021, Antonio Niño Díaz
+
+#include "simulation/profile.h"
+
+#ifdef SIM_PROFILE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "date.h"
+
+// Number of simulation steps remembered in the ring buffer
+#define PROFILE_MAX_STEPS       1024
+
+typedef struct {
+    uint32_t step;
+    uint16_t month;
+    uint16_t year;
+    uint32_t phase_ns[SIM_PHASE_NUMBER];
+    uint32_t total_ns;
+} profile_record;
+
+static profile_record records[PROFILE_MAX_STEPS];
+static int records_next;  // Index to write the next record to
+static int records_count; // Number of valid records in the ring buffer
+
+static uint32_t step_count;
+
+static profile_record current;
+static uint64_t step_start_ns;
+static uint64_t last_mark_ns;
+
+static const char *phase_names[SIM_PHASE_NUMBER] = {
+    [SIM_PHASE_CREATE_BUILDINGS] = "create_buildings",
+    [SIM_PHASE_POWER] = "power",
+    [SIM_PHASE_TRAFFIC] = "traffic",
+    [SIM_PHASE_SERVICES] = "services",
+    [SIM_PHASE_POLLUTION] = "pollution",
+    [SIM_PHASE_FLAG_CREATE_BUILDINGS] = "flag_create_buildings",
+    [SIM_PHASE_STATISTICS] = "statistics",
+    [SIM_PHASE_RCI_DEMAND] = "rci_demand",
+    [SIM_PHASE_DATE_BUDGET] = "date_budget",
+    [SIM_PHASE_DISASTERS] = "disasters",
+    [SIM_PHASE_RADIATION] = "radiation",
+    [SIM_PHASE_GRAPHS] = "graphs",
+    [SIM_PHASE_FIRE] = "fire",
+};
+
+static uint64_t Profile_Time_ns(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void Simulation_ProfileStepStart(void)
+{
+    memset(&current, 0, sizeof(current));
+
+    current.step = step_count++;
+    current.month = DateGetMonth();
+    current.year = DateGetYear();
+
+    step_start_ns = Profile_Time_ns();
+    last_mark_ns = step_start_ns;
+}
+
+void Simulation_ProfileMark(sim_phase phase)
+{
+    uint64_t now = Profile_Time_ns();
+
+    current.phase_ns[phase] += (uint32_t)(now - last_mark_ns);
+
+    last_mark_ns = now;
+}
+
+void Simulation_ProfileStepEnd(void)
+{
+    current.total_ns = (uint32_t)(Profile_Time_ns() - step_start_ns);
+
+    records[records_next] = current;
+
+    records_next = (records_next + 1) % PROFILE_MAX_STEPS;
+    if (records_count < PROFILE_MAX_STEPS)
+        records_count++;
+}
+
+int Simulation_ProfileDumpCSV(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        return -1;
+
+    fprintf(f, "step,month,year");
+    for (int i = 0; i < SIM_PHASE_NUMBER; i++)
+        fprintf(f, ",%s", phase_names[i]);
+    fprintf(f, ",total\n");
+
+    // Print the oldest record first
+    int index = records_next - records_count;
+    if (index < 0)
+        index += PROFILE_MAX_STEPS;
+
+    for (int n = 0; n < records_count; n++)
+    {
+        const profile_record *r = &records[index];
+
+        fprintf(f, "%u,%u,%u", (unsigned int)r->step,
+                (unsigned int)r->month, (unsigned int)r->year);
+        for (int i = 0; i < SIM_PHASE_NUMBER; i++)
+            fprintf(f, ",%u", (unsigned int)r->phase_ns[i]);
+        fprintf(f, ",%u\n", (unsigned int)r->total_ns);
+
+        index = (index + 1) % PROFILE_MAX_STEPS;
+    }
+
+    fclose(f);
+
+    return 0;
+}
+
+#endif // SIM_PROFILE
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (c) 2021, Antonio Niño Díaz
+
+#ifndef SIMULATION_PROFILE_H__
+#define SIMULATION_PROFILE_H__
+
+// Optional instrumentation of Simulation_SimulateAll(). It is only compiled in
+// if SIM_PROFILE is defined (CMake option ENABLE_SIM_PROFILE, SDL2 build only).
+// If not, all the macros below do nothing.
+
+typedef enum {
+    SIM_PHASE_CREATE_BUILDINGS,
+    SIM_PHASE_POWER,
+    SIM_PHASE_TRAFFIC,
+    SIM_PHASE_SERVICES,
+    SIM_PHASE_POLLUTION,
+    SIM_PHASE_FLAG_CREATE_BUILDINGS,
+    SIM_PHASE_STATISTICS,
+    SIM_PHASE_RCI_DEMAND,
+    SIM_PHASE_DATE_BUDGET,
+    SIM_PHASE_DISASTERS,
+    SIM_PHASE_RADIATION,
+    SIM_PHASE_GRAPHS,
+    SIM_PHASE_FIRE, // Only in disaster mode
+
+    SIM_PHASE_NUMBER
+} sim_phase;
+
+#ifdef SIM_PROFILE
+
+// Start measuring a new simulation step
+void Simulation_ProfileStepStart(void);
+// Assign the time since the previous mark (or the start of the step) to the
+// specified phase
+void Simulation_ProfileMark(sim_phase phase);
+// Save the timings of this step in the ring buffer
+void Simulation_ProfileStepEnd(void);
+
+// Save the contents of the ring buffer as CSV (times in nanoseconds). Returns 0
+// on success.
+int Simulation_ProfileDumpCSV(const char *path);
+
+#define SIM_PROFILE_STEP_START()    Simulation_ProfileStepStart()
+#define SIM_PROFILE_MARK(phase)     Simulation_ProfileMark(phase)
+#define SIM_PROFILE_STEP_END()      Simulation_ProfileStepEnd()
+
+#else
+
+#define SIM_PROFILE_STEP_START()    do { } while (0)
+#define SIM_PROFILE_MARK(phase)     do { } while (0)
+#define SIM_PROFILE_STEP_END()      do { } while (0)
+
+#endif // SIM_PROFILE
+
+#endif // SIMULATION_PROFILE_H__
@@ -4,61 +4,68 @@
 
 #include <stdint.h>
 
-// The functions in this file implement a FIFO circular buffer
-
-int queue_in_ptr;  // Pointer to the place where to add elements
-int queue_out_ptr; // Pointer to the place where to read elements
+#include <ugba/ugba.h>
 
-#define BUFFER_SIZE     (1024)
+#include "simulation/queue.h"
 
-static int circular_buffer[BUFFER_SIZE];
+// The functions in this file implement a FIFO circular buffer
 
-void QueueInit(void)
+IWRAM_CODE void QueueInit(queue *q)
 {
     // Reset pointers
-    queue_in_ptr = 0;
-    queue_out_ptr = 0;
+    q->in_ptr = 0;
+    q->out_ptr = 0;
+    q->count = 0;
 }
 
-void QueueAdd(uint32_t value)
+IWRAM_CODE void QueueAdd(queue *q, uint16_t value)
 {
-    circular_buffer[queue_in_ptr++] = value;
+    if (q->count == q->size)
+    {
+        UGBA_Assert(0);
+        q->overflow = 1;
+        return;
+    }
+
+    q->buffer[q->in_ptr++] = value;
 
-    if (queue_in_ptr == BUFFER_SIZE)
-        queue_in_ptr = 0;
+    if (q->in_ptr == q->size)
+        q->in_ptr = 0;
 
-    // TODO: Check for overflows
+    q->count++;
+    if (q->count > q->high_water)
+        q->high_water = q->count;
 }
 
-uint32_t QueueGet(void)
+IWRAM_CODE uint16_t QueueGet(queue *q)
 {
-    uint32_t value = circular_buffer[queue_out_ptr++];
+    UGBA_Assert(q->count > 0);
 
-    if (queue_out_ptr == BUFFER_SIZE)
-        queue_out_ptr = 0;
+    uint16_t value = q->buffer[q->out_ptr++];
 
-    // TODO: Check for underflows
+    if (q->out_ptr == q->size)
+        q->out_ptr = 0;
+
+    q->count--;
 
     return value;
 }
 
-void QueueAddPair(uint16_t a, uint16_t b)
+// Returns 1 if empty
+IWRAM_CODE int QueueIsEmpty(const queue *q)
 {
-    QueueAdd(((uint32_t)a << 16) | b);
+    if (q->count == 0)
+        return 1;
+
+    return 0;
 }
 
-void QueueGetPair(uint16_t *a, uint16_t *b)
+int QueueHighWaterMark(const queue *q)
 {
-    uint32_t val = QueueGet();
-    *a = val >> 16;
-    *b = val & 0xFFFF;
+    return q->high_water;
 }
 
-// Returns 1 if empty
-int QueueIsEmpty(void)
+int QueueHasOverflowed(const queue *q)
 {
-    if (queue_out_ptr == queue_in_ptr)
-        return 1;
-
-    return 0;
+    return q->overflow;
 }
@@ -7,14 +7,36 @@
 
 #include <stdint.h>
 
-void QueueInit(void);
+// FIFO circular buffer of 16-bit values. Each user of a queue must provide its
+// own buffer, sized for the worst case of that user.
+typedef struct {
+    uint16_t *buffer;
+    int size;       // Number of elements of the buffer
+    int in_ptr;     // Index of the place where to add elements
+    int out_ptr;    // Index of the place where to read elements
+    int count;      // Number of elements in the queue
+    int high_water; // Max number of elements in the queue at any point
+    int overflow;   // 1 if any element has been dropped
+} queue;
 
-void QueueAdd(int value);
-int QueueGet(void);
+// Initializer of a queue that uses the specified array as buffer:
+//
+//     static uint16_t buffer[SIZE];
+//     static queue q = QUEUE_INITIALIZER(buffer);
+#define QUEUE_INITIALIZER(array) \
+    { .buffer = (array), .size = sizeof(array) / sizeof((array)[0]) }
+
+// Remove all elements. The statistics aren't cleared.
+void QueueInit(queue *q);
+
+// If the queue is full, the element is dropped and the queue is flagged as
+// overflowed.
+void QueueAdd(queue *q, uint16_t value);
+uint16_t QueueGet(queue *q);
 
-void QueueAddPair(uint16_t a, uint16_t b);
-void QueueGetPair(uint16_t *a, uint16_t *b);
+int QueueIsEmpty(const queue *q);
 
-int QueueIsEmpty(void);
+int QueueHighWaterMark(const queue *q);
+int QueueHasOverflowed(const queue *q);
 
 #endif // SIMULATION_QUEUE_H__
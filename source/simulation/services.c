@@ -2,22 +2,56 @@
 //
 // Copyright (c) 2021, Antonio Niño Díaz
 
+#include <stddef.h>
 #include <stdint.h>
-#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <ugba/ugba.h>
 
 #include "room_game/draw_common.h"
 #include "room_game/room_game.h"
+#include "room_game/tileset_info.h"
+#include "simulation/building_registry.h"
+#include "simulation/common.h"
 #include "simulation/happiness.h"
+#include "simulation/services.h"
 
 // Min level of adequate service coverage
 #define SERVICE_MIN_LEVEL   (256 / 4)
 
+// Coverage of each service. The masks of service buildings are added when they
+// start working and subtracted when they stop working. The values saturate at
+// 255, which is the highest value that the users of the coverage can see.
+EWRAM_BSS static
+uint8_t services_coverage[SERVICE_NUMBER][CITY_MAP_WIDTH * CITY_MAP_HEIGHT];
+
+// Bitplanes of the tiles whose coverage has saturated. Their real coverage is
+// unknown, so a mask can't be subtracted from them. If a building that covers
+// any of them stops working, the coverage of the service is calculated again.
+EWRAM_BSS static uint64_t services_saturated[SERVICE_NUMBER][CITY_MAP_HEIGHT];
+
+// Bitplanes with the central tiles of the buildings whose mask has been added
+// to the coverage of each service.
+EWRAM_BSS static uint64_t services_stamped[SERVICE_NUMBER][CITY_MAP_HEIGHT];
+
+// Bitplanes with the central tiles of the buildings that are working now
+EWRAM_BSS static uint64_t services_working[SERVICE_NUMBER][CITY_MAP_HEIGHT];
+
+// Map of the last service simulated, only generated on request
 EWRAM_BSS static uint8_t services_matrix[CITY_MAP_WIDTH * CITY_MAP_HEIGHT];
 
+static service_type services_last = SERVICE_POLICE;
+
 uint8_t *Simulation_ServicesGetMap(void)
 {
+    const uint8_t *coverage = &services_coverage[services_last][0];
+
+    for (int i = 0; i < CITY_MAP_WIDTH * CITY_MAP_HEIGHT; i++)
+        services_matrix[i] = coverage[i];
+
     return &services_matrix[0];
 }
 
@@ -116,187 +150,6 @@ const uint8_t SERVICES_INFLUENCE_MASK[SERVICES_MASK_WIDTH * SERVICES_MASK_HEIGHT
     0x00, 0x00, 0x00, 0x00,
 };
 
-// Coordinates are the center of the mask
-IWRAM_CODE static void Simulation_ServicesApplyMask(int x, int y)
-{
-    int sx = x - SERVICES_MASK_CENTER_X;
-    int sy = y - SERVICES_MASK_CENTER_Y;
-
-    for (int j = 0; j < SERVICES_MASK_HEIGHT; j++)
-    {
-        int mapy = j + sy;
-
-        if (mapy < 0)
-            continue;
-
-        if (mapy >= CITY_MAP_HEIGHT)
-            break;
-
-        for (int i = 0; i < SERVICES_MASK_WIDTH; i++)
-        {
-            int mapx = i + sx;
-
-            if (mapx < 0)
-                continue;
-
-            if (mapx >= CITY_MAP_WIDTH)
-                break;
-
-            int val = SERVICES_INFLUENCE_MASK[j * SERVICES_MASK_WIDTH + i];
-            int old = services_matrix[mapy * CITY_MAP_WIDTH + mapx];
-
-            val += old;
-
-            if (val > 255)
-                services_matrix[mapy * CITY_MAP_WIDTH + mapx] = 255;
-            else
-                services_matrix[mapy * CITY_MAP_WIDTH + mapx] = val;
-        }
-    }
-}
-
-IWRAM_CODE void Simulation_ServicesSetTileOkFlag(void)
-{
-    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
-    {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
-        {
-            uint16_t type = CityMapGetType(i, j) & TYPE_MASK;
-
-            if ((type == TYPE_FIELD) || (type == TYPE_FOREST) ||
-                (type == TYPE_WATER) || (type == TYPE_DOCK))
-            {
-                // Ignore non-building tiles. Flag it as ok!
-                Simulation_HappinessSetFlags(i, j, TILE_OK_SERVICES);
-            }
-            else
-            {
-                // Buildings require a level check...
-                int services = services_matrix[j * CITY_MAP_WIDTH + i];
-
-                // Check if there is enough coverage
-                if (services >= SERVICE_MIN_LEVEL)
-                    Simulation_HappinessSetFlags(i, j, TILE_OK_SERVICES);
-                else
-                    Simulation_HappinessResetFlags(i, j, TILE_OK_SERVICES);
-            }
-        }
-    }
-}
-
-// Like Simulation_ServicesSetTileOkFlag(), but can only set to 1 if it was 1
-// before.
-IWRAM_CODE void Simulation_ServicesAddTileOkFlag(void)
-{
-    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
-    {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
-        {
-            if ((Simulation_HappinessGetFlags(i, j) & TILE_OK_SERVICES) == 0)
-                continue;
-
-            uint16_t type = CityMapGetType(i, j) & TYPE_MASK;
-
-            if ((type == TYPE_FIELD) || (type == TYPE_FOREST) ||
-                (type == TYPE_WATER) || (type == TYPE_DOCK))
-            {
-                // Ignore non-building tiles. Leave it as ok!
-                continue;
-            }
-            else
-            {
-                // Buildings require a level check...
-                int services = services_matrix[j * CITY_MAP_WIDTH + i];
-
-                // Check if there is enough coverage
-                if (services < SERVICE_MIN_LEVEL)
-                    Simulation_HappinessResetFlags(i, j, TILE_OK_SERVICES);
-            }
-        }
-    }
-}
-
-IWRAM_CODE void Simulation_EducationSetTileOkFlag(void)
-{
-    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
-    {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
-        {
-            uint16_t type = CityMapGetType(i, j) & TYPE_MASK;
-
-            if ((type == TYPE_FIELD) || (type == TYPE_FOREST) ||
-                (type == TYPE_WATER) || (type == TYPE_DOCK))
-            {
-                // Ignore non-building tiles. Flag it as ok!
-                Simulation_HappinessSetFlags(i, j, TILE_OK_EDUCATION);
-            }
-            else
-            {
-                // Buildings require a level check...
-                int education = services_matrix[j * CITY_MAP_WIDTH + i];
-
-                // Check if there is enough coverage
-                if (education >= SERVICE_MIN_LEVEL)
-                    Simulation_HappinessSetFlags(i, j, TILE_OK_EDUCATION);
-                else
-                    Simulation_HappinessResetFlags(i, j, TILE_OK_EDUCATION);
-            }
-        }
-    }
-}
-
-// Like Simulation_EducationSetTileOkFlag(), but can only set to 1 if it was 1
-// before.
-IWRAM_CODE void Simulation_EducationAddTileOkFlag(void)
-{
-    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
-    {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
-        {
-            if ((Simulation_HappinessGetFlags(i, j) & TILE_OK_EDUCATION) == 0)
-                continue;
-
-            uint16_t type = CityMapGetType(i, j) & TYPE_MASK;
-
-            if ((type == TYPE_FIELD) || (type == TYPE_FOREST) ||
-                (type == TYPE_WATER) || (type == TYPE_DOCK))
-            {
-                // Ignore non-building tiles. Leave it as ok!
-                continue;
-            }
-            else
-            {
-                // Buildings require a level check...
-                int education = services_matrix[j * CITY_MAP_WIDTH + i];
-
-                // Check if there is enough coverage
-                if (education < SERVICE_MIN_LEVEL)
-                    Simulation_HappinessResetFlags(i, j, TILE_OK_EDUCATION);
-            }
-        }
-    }
-}
-
-// Central tile of the building (tileset_info.h)
-IWRAM_CODE void Simulation_Services(uint16_t source_tile)
-{
-    memset(services_matrix, 0, sizeof(services_matrix));
-
-    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
-    {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
-        {
-            if (CityMapGetTile(i, j) == source_tile)
-            {
-                // If there is no power, ignore this building
-                uint8_t flags = Simulation_HappinessGetFlags(i, j);
-                if (flags & TILE_OK_POWER)
-                    Simulation_ServicesApplyMask(i, j);
-            }
-        }
-    }
-}
-
 #define SERVICES_MASK_BIG_WIDTH     64
 #define SERVICES_MASK_BIG_HEIGHT    64
 
@@ -649,61 +502,386 @@ static uint8_t SERVICES_INFLUENCE_MASK_BIG[
     0x00, 0x00, 0x00, 0x00,
 };
 
-// Coordinates are the center of the mask
-IWRAM_CODE static void Simulation_ServicesApplyMaskBig(int x, int y)
+typedef struct {
+    uint16_t source_tile; // Central tile of the building (tileset_info.h)
+    const uint8_t *mask;
+    int mask_width, mask_height;
+    int mask_center_x, mask_center_y;
+    int education; // 1 if it affects TILE_OK_EDUCATION, 0 if TILE_OK_SERVICES
+} service_info;
+
+#define SERVICE_MASK_SMALL                                              \
+    SERVICES_INFLUENCE_MASK, SERVICES_MASK_WIDTH, SERVICES_MASK_HEIGHT, \
+    SERVICES_MASK_CENTER_X, SERVICES_MASK_CENTER_Y
+
+#define SERVICE_MASK_BIG                                                \
+    SERVICES_INFLUENCE_MASK_BIG, SERVICES_MASK_BIG_WIDTH,               \
+    SERVICES_MASK_BIG_HEIGHT, SERVICES_MASK_BIG_CENTER_X,               \
+    SERVICES_MASK_BIG_CENTER_Y
+
+static const service_info SERVICES_INFO[SERVICE_NUMBER] = {
+    [SERVICE_POLICE] = { T_POLICE_DEPT_CENTER, SERVICE_MASK_SMALL, 0 },
+    [SERVICE_FIRE] = { T_FIRE_DEPT_CENTER, SERVICE_MASK_SMALL, 0 },
+    [SERVICE_HOSPITAL] = { T_HOSPITAL_CENTER, SERVICE_MASK_SMALL, 0 },
+    [SERVICE_SCHOOL] = { T_SCHOOL_CENTER, SERVICE_MASK_SMALL, 1 },
+    [SERVICE_HIGH_SCHOOL] = { T_HIGH_SCHOOL_CENTER, SERVICE_MASK_BIG, 1 },
+};
+
+// Adds a row of a mask to a row of the coverage of a service if `sign` is 1, or
+// subtracts it if `sign` is -1. The row starts at column `x` of the map, and
+// the tiles that saturate are flagged in `saturated`, the row of the bitplane.
+IWRAM_CODE static void Simulation_ServicesApplyMaskRow(uint8_t *coverage,
+                                                       uint64_t *saturated,
+                                                       int x,
+                                                       const uint8_t *mask,
+                                                       size_t len, int sign)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Add or subtract 16 values of the mask at a time. The tiles that saturate
+    // are the ones whose saturated sum is different from the wrapped sum.
+
+    for ( ; i + 16 <= len; i += 16)
+    {
+        __m128i m = _mm_loadu_si128((const __m128i *)&mask[i]);
+
+        __m128i *dst = (__m128i *)&coverage[i];
+        __m128i c = _mm_loadu_si128(dst);
+
+        if (sign > 0)
+        {
+            __m128i sum = _mm_adds_epu8(c, m);
+            __m128i wrapped = _mm_add_epi8(c, m);
+
+            uint32_t same = _mm_movemask_epi8(_mm_cmpeq_epi8(sum, wrapped));
+            *saturated |= (uint64_t)(~same & 0xFFFF) << (x + i);
+
+            c = sum;
+        }
+        else
+        {
+            c = _mm_sub_epi8(c, m);
+        }
+
+        _mm_storeu_si128(dst, c);
+    }
+#endif
+
+    for ( ; i < len; i++)
+    {
+        if (sign > 0)
+        {
+            int value = coverage[i] + mask[i];
+
+            if (value > 255)
+            {
+                value = 255;
+                *saturated |= (uint64_t)1 << (x + i);
+            }
+
+            coverage[i] = value;
+        }
+        else
+        {
+            coverage[i] -= mask[i];
+        }
+    }
+}
+
+// Calculates the area of the map covered by a mask with its center at the
+// specified coordinates. The area is returned as the top left corner of the
+// mask in the map, and the range of columns and rows of the mask inside the
+// map. Returns 0 if the mask is outside of the map.
+IWRAM_CODE static int Simulation_ServicesClipMask(const service_info *info,
+                                                  int x, int y,
+                                                  int *sx, int *sy,
+                                                  int *i_start, int *i_end,
+                                                  int *j_start, int *j_end)
+{
+    *sx = x - info->mask_center_x;
+    *sy = y - info->mask_center_y;
+
+    *i_start = (*sx < 0) ? -*sx : 0;
+    *j_start = (*sy < 0) ? -*sy : 0;
+
+    *i_end = CITY_MAP_WIDTH - *sx;
+    if (*i_end > info->mask_width)
+        *i_end = info->mask_width;
+
+    *j_end = CITY_MAP_HEIGHT - *sy;
+    if (*j_end > info->mask_height)
+        *j_end = info->mask_height;
+
+    return (*i_start < *i_end) && (*j_start < *j_end);
+}
+
+// Coordinates are the center of the mask. The mask is added to the coverage if
+// `sign` is 1, and subtracted if it is -1.
+IWRAM_CODE static void Simulation_ServicesApplyMask(service_type service,
+                                                    int x, int y, int sign)
 {
-    int sx = x - SERVICES_MASK_BIG_CENTER_X;
-    int sy = y - SERVICES_MASK_BIG_CENTER_Y;
+    const service_info *info = &SERVICES_INFO[service];
+
+    int sx, sy, i_start, i_end, j_start, j_end;
+    if (!Simulation_ServicesClipMask(info, x, y, &sx, &sy,
+                                     &i_start, &i_end, &j_start, &j_end))
+        return;
+
+    uint8_t *coverage = &services_coverage[service][0];
 
-    for (int j = 0; j < SERVICES_MASK_BIG_HEIGHT; j++)
+    for (int j = j_start; j < j_end; j++)
     {
-        int mapy = j + sy;
+        Simulation_ServicesApplyMaskRow(
+                &coverage[(sy + j) * CITY_MAP_WIDTH + sx + i_start],
+                &services_saturated[service][sy + j], sx + i_start,
+                &info->mask[j * info->mask_width + i_start],
+                i_end - i_start, sign);
+    }
+}
+
+// Returns 1 if the mask with its center at the specified coordinates covers any
+// tile whose coverage has saturated.
+IWRAM_CODE static int Simulation_ServicesMaskIsSaturated(service_type service,
+                                                         int x, int y)
+{
+    const service_info *info = &SERVICES_INFO[service];
 
-        if (mapy < 0)
+    int sx, sy, i_start, i_end, j_start, j_end;
+    if (!Simulation_ServicesClipMask(info, x, y, &sx, &sy,
+                                     &i_start, &i_end, &j_start, &j_end))
+        return 0;
+
+    int width = i_end - i_start;
+    uint64_t columns = (width == 64) ? UINT64_MAX : ((uint64_t)1 << width) - 1;
+    columns <<= sx + i_start;
+
+    for (int j = j_start; j < j_end; j++)
+    {
+        if (services_saturated[service][sy + j] & columns)
+            return 1;
+    }
+
+    return 0;
+}
+
+// Flags the central tile of all buildings of the specified services that have
+// power. They are taken from the building registry, so all services are handled
+// in the same pass over the list of buildings.
+IWRAM_CODE static void Simulation_ServicesFindWorking(uint32_t services)
+{
+    for (int s = 0; s < SERVICE_NUMBER; s++)
+    {
+        if ((services & (1 << s)) == 0)
             continue;
 
-        if (mapy >= CITY_MAP_HEIGHT)
-            break;
+        for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+            services_working[s][j] = 0;
+    }
+
+    building_registry_iterator it;
+    building_registry_entry building;
 
-        for (int i = 0; i < SERVICES_MASK_BIG_WIDTH; i++)
+    BuildingRegistryIteratorStart(&it);
+
+    while (BuildingRegistryIteratorNext(&it, &building))
+    {
+        for (int s = 0; s < SERVICE_NUMBER; s++)
         {
-            int mapx = i + sx;
+            if ((services & (1 << s)) == 0)
+                continue;
+
+            uint16_t source_tile = SERVICES_INFO[s].source_tile;
 
-            if (mapx < 0)
+            // The central tile has the offset to the top left tile
+            const city_tile_info *info = City_Tileset_Entry_Info(source_tile);
+
+            int x = building.x - info->base_x_delta;
+            int y = building.y - info->base_y_delta;
+
+            if ((x >= CITY_MAP_WIDTH) || (y >= CITY_MAP_HEIGHT))
                 continue;
 
-            if (mapx >= CITY_MAP_WIDTH)
-                break;
+            if (CityMapGetTile(x, y) != source_tile)
+                continue;
 
-            int val = SERVICES_INFLUENCE_MASK_BIG[j * SERVICES_MASK_BIG_WIDTH + i];
-            int old = services_matrix[mapy * CITY_MAP_HEIGHT + mapx];
+            // If there is no power, ignore this building
+            uint8_t flags = Simulation_HappinessGetFlags(x, y);
+            if (flags & TILE_OK_POWER)
+                services_working[s][y] |= (uint64_t)1 << x;
 
-            val += old;
+            // A building can only be the source of one service
+            break;
+        }
+    }
+}
 
-            if (val > 255)
-                services_matrix[mapy * CITY_MAP_HEIGHT + mapx] = 255;
-            else
-                services_matrix[mapy * CITY_MAP_HEIGHT + mapx] = val;
+// Updates the coverage of the specified services. Only the masks of the
+// buildings that have started or stopped working since the last time are added
+// or subtracted.
+IWRAM_CODE static void Simulation_ServicesUpdate(uint32_t services)
+{
+    Simulation_ServicesFindWorking(services);
+
+    for (int s = 0; s < SERVICE_NUMBER; s++)
+    {
+        if ((services & (1 << s)) == 0)
+            continue;
+
+        // Masks can only be subtracted if none of the tiles they cover have
+        // saturated. If not, calculate the coverage from scratch.
+
+        int rebuild = 0;
+
+        for (int j = 0; (j < CITY_MAP_HEIGHT) && !rebuild; j++)
+        {
+            uint64_t stopped = services_stamped[s][j] & ~services_working[s][j];
+
+            while (stopped != 0)
+            {
+                int i = __builtin_ctzll(stopped);
+                stopped &= stopped - 1;
+
+                if (Simulation_ServicesMaskIsSaturated(s, i, j))
+                {
+                    rebuild = 1;
+                    break;
+                }
+            }
+        }
+
+        if (rebuild)
+        {
+            for (int i = 0; i < CITY_MAP_WIDTH * CITY_MAP_HEIGHT; i++)
+                services_coverage[s][i] = 0;
+
+            for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+            {
+                services_saturated[s][j] = 0;
+                services_stamped[s][j] = 0;
+            }
+        }
+
+        // Subtract all masks before adding any of them so that no mask is
+        // subtracted from tiles saturated by the new masks.
+
+        for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+        {
+            uint64_t stopped = services_stamped[s][j] & ~services_working[s][j];
+
+            while (stopped != 0)
+            {
+                int i = __builtin_ctzll(stopped);
+                stopped &= stopped - 1;
+
+                Simulation_ServicesApplyMask(s, i, j, -1);
+            }
+        }
+
+        for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+        {
+            uint64_t started = services_working[s][j] & ~services_stamped[s][j];
+
+            while (started != 0)
+            {
+                int i = __builtin_ctzll(started);
+                started &= started - 1;
+
+                Simulation_ServicesApplyMask(s, i, j, 1);
+            }
+
+            services_stamped[s][j] = services_working[s][j];
         }
     }
 }
 
 // Central tile of the building (tileset_info.h)
+IWRAM_CODE void Simulation_Services(uint16_t source_tile)
+{
+    for (int s = 0; s < SERVICE_NUMBER; s++)
+    {
+        if (SERVICES_INFO[s].source_tile != source_tile)
+            continue;
+
+        Simulation_ServicesUpdate(1 << s);
+
+        services_last = s;
+        return;
+    }
+
+    UGBA_Assert(0);
+}
+
 IWRAM_CODE void Simulation_ServicesBig(uint16_t source_tile)
 {
-    memset(services_matrix, 0, sizeof(services_matrix));
+    Simulation_Services(source_tile);
+}
+
+// Sets the TILE_OK_SERVICES and TILE_OK_EDUCATION flags of all tiles. A tile is
+// fine if the level of all the specified services that affect a flag are high
+// enough. Non-building tiles are always fine.
+IWRAM_CODE static void Simulation_ServicesSetTileOkFlags(uint32_t services)
+{
+    uint64_t *services_plane =
+            Simulation_HappinessGetPlane(TILE_OK_SERVICES_BIT);
+    uint64_t *education_plane =
+            Simulation_HappinessGetPlane(TILE_OK_EDUCATION_BIT);
+
+    const uint8_t *type_matrix = TypeMatrixGet();
 
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
+        uint64_t ignored = 0;
+        uint64_t services_ok = 0;
+        uint64_t education_ok = 0;
+
         for (int i = 0; i < CITY_MAP_WIDTH; i++)
         {
-            if (CityMapGetTile(i, j) == source_tile)
+            int index = j * CITY_MAP_WIDTH + i;
+
+            uint16_t type = type_matrix[index] & TYPE_MASK;
+
+            if ((type == TYPE_FIELD) || (type == TYPE_FOREST) ||
+                (type == TYPE_WATER) || (type == TYPE_DOCK))
             {
-                // If there is no power, ignore this building
-                uint8_t flags = Simulation_HappinessGetFlags(i, j);
-                if (flags & TILE_OK_POWER)
-                    Simulation_ServicesApplyMaskBig(i, j);
+                // Ignore non-building tiles. Flag it as ok!
+                ignored |= (uint64_t)1 << i;
+                continue;
             }
+
+            // Buildings require a level check...
+
+            int is_ok[2] = { 1, 1 };
+
+            for (int s = 0; s < SERVICE_NUMBER; s++)
+            {
+                if ((services & (1 << s)) == 0)
+                    continue;
+
+                if (services_coverage[s][index] < SERVICE_MIN_LEVEL)
+                    is_ok[SERVICES_INFO[s].education] = 0;
+            }
+
+            services_ok |= (uint64_t)is_ok[0] << i;
+            education_ok |= (uint64_t)is_ok[1] << i;
         }
+
+        services_plane[j] = ignored | services_ok;
+        education_plane[j] = ignored | education_ok;
+    }
+}
+
+IWRAM_CODE void Simulation_ServicesAll(uint32_t services)
+{
+    Simulation_ServicesUpdate(services);
+
+    Simulation_ServicesSetTileOkFlags(services);
+
+    // Simulation_ServicesGetMap() returns the map of the last service
+
+    for (int s = 0; s < SERVICE_NUMBER; s++)
+    {
+        if (services & (1 << s))
+            services_last = s;
     }
 }
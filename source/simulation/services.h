@@ -7,16 +7,29 @@
 
 #include <stdint.h>
 
+typedef enum {
+    SERVICE_POLICE,
+    SERVICE_FIRE,
+    SERVICE_HOSPITAL,
+    SERVICE_SCHOOL,
+    SERVICE_HIGH_SCHOOL,
+
+    SERVICE_NUMBER
+} service_type;
+
+// Simulate the coverage of all the specified services (a mask of bits with the
+// format 1 << SERVICE_xxx) at the same time, and set the TILE_OK_SERVICES and
+// TILE_OK_EDUCATION flags from the coverage of all of them.
+void Simulation_ServicesAll(uint32_t services);
+
+// Simulate only the coverage of one service, without modifying the flags.
 // Central tile of the building (tileset_info.h)
 void Simulation_Services(uint16_t source_tile);
 void Simulation_ServicesBig(uint16_t source_tile);
 
+// Returns the coverage of the last service simulated (or the last one of the
+// mask passed to Simulation_ServicesAll()).
 uint8_t *Simulation_ServicesGetMap(void);
 
-void Simulation_ServicesSetTileOkFlag(void);
-void Simulation_ServicesAddTileOkFlag(void);
-void Simulation_EducationSetTileOkFlag(void);
-void Simulation_EducationAddTileOkFlag(void);
-
 #endif // SIMULATION_SERVICES_H__
 
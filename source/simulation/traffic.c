@@ -12,8 +12,10 @@
 #include "room_game/text_messages.h"
 #include "room_game/tileset_info.h"
 #include "simulation/building_density.h"
-#include "simulation/queue.h"
+#include "simulation/bucket_queue.h"
+#include "simulation/building_registry.h"
 #include "simulation/building_count.h"
+#include "simulation/epoch_grid.h"
 #include "simulation/happiness.h"
 
 #define TRAFFIC_MAX_LEVEL       (256 / 6) // Max level of adequate traffic
@@ -22,12 +24,78 @@
 EWRAM_BSS static uint8_t traffic_map[CITY_MAP_HEIGHT * CITY_MAP_WIDTH];
 EWRAM_BSS static uint8_t scratch_map[CITY_MAP_HEIGHT * CITY_MAP_WIDTH];
 
+// Bitboards with one bit per tile. The first one has the tiles of traffic_map[]
+// that have been written since the map was cleared, the second one has the
+// tiles that may have changed since the last time someone cleared its bits.
+EWRAM_BSS static uint64_t traffic_written[CITY_MAP_HEIGHT];
+EWRAM_BSS static uint64_t traffic_changed[CITY_MAP_HEIGHT];
+
+// Path used to get to each road, train tracks or destination building tile with
+// the cost stored in scratch_map[]. The bottom bits hold the index of the top
+// left tile of the source of traffic that got there, and the top bits hold the
+// direction of the tile used to get there. It is only valid in tiles with a
+// cost != 0.
+EWRAM_BSS static uint16_t path_map[CITY_MAP_HEIGHT * CITY_MAP_WIDTH];
+
+#define TRAFFIC_PATH_PARENT_SHIFT   12
+#define TRAFFIC_PATH_OWNER_MASK     ((1 << TRAFFIC_PATH_PARENT_SHIFT) - 1)
+
+// Search that has written each tile of scratch_map[] and path_map[]. Tiles
+// written by a previous search are treated as if their cost was 0, so the maps
+// don't need to be cleared before each search.
+EWRAM_BSS static uint8_t scratch_stamps[CITY_MAP_HEIGHT * CITY_MAP_WIDTH];
+static epoch_grid scratch_epoch = EPOCH_GRID_INITIALIZER(scratch_stamps);
+
+#define TRAFFIC_PARENT_NONE     0 // Tile next to the source building
+#define TRAFFIC_PARENT_UP       1
+#define TRAFFIC_PARENT_DOWN     2
+#define TRAFFIC_PARENT_LEFT     3
+#define TRAFFIC_PARENT_RIGHT    4
+
+// Elements of the queue are the index of the tile in the map, and their key is
+// the accumulated cost to get to the tile. Tiles are expanded in increasing
+// order of accumulated cost, so each road or train tracks tile is only expanded
+// once per source. When a cheaper path to a tile that is in the queue is found,
+// the tile is moved to the bucket of the new cost. Destination buildings are
+// handled the same way, so a tile is never in the queue more than once and the
+// queue needs one element per tile of the map.
+#define TRAFFIC_MAX_COST        255
+
+EWRAM_BSS static bucket_queue_node
+        traffic_queue_nodes[CITY_MAP_HEIGHT * CITY_MAP_WIDTH +
+                            TRAFFIC_MAX_COST + 1];
+static bucket_queue traffic_queue =
+        BUCKET_QUEUE_INITIALIZER(traffic_queue_nodes, TRAFFIC_MAX_COST + 1);
+
+const bucket_queue *Simulation_TrafficGetQueue(void)
+{
+    return &traffic_queue;
+}
+
 // Amount of tiles with traffic jams.
 int simulation_traffic_jam_num_tiles;
 int simulation_traffic_jam_num_tiles_percent;
 
-// Remaining density in the residential building being handled at the moment.
-int source_building_remaining_density;
+// Bitplane of the top left tiles of the residential buildings with population.
+// They are handled in raster order. While looking for destinations, the
+// population of each one of them that hasn't found a destination is stored in
+// traffic_map[] in its top left tile.
+EWRAM_BSS static uint64_t traffic_sources[CITY_MAP_HEIGHT];
+
+// Number of sources of the current search that have remaining density
+static int traffic_live_sources;
+
+static int traffic_batched;
+
+void Simulation_TrafficSetBatched(int enable)
+{
+    traffic_batched = enable;
+}
+
+int Simulation_TrafficIsBatched(void)
+{
+    return traffic_batched;
+}
 
 IWRAM_CODE static int min(int a, int b)
 {
@@ -46,6 +114,18 @@ uint8_t *Simulation_TrafficGetMap(void)
     return &traffic_map[0];
 }
 
+uint64_t *Simulation_TrafficGetChangedPlane(void)
+{
+    return &traffic_changed[0];
+}
+
+IWRAM_CODE static void TrafficMapSet(int index, int value)
+{
+    traffic_map[index] = value;
+    traffic_written[index / CITY_MAP_WIDTH] |=
+            (uint64_t)1 << (index % CITY_MAP_WIDTH);
+}
+
 // Returns remaining density of a building from any tile of it.
 IWRAM_CODE static uint8_t *TrafficGetBuildingiRemainingDensityPointer(int x, int y)
 {
@@ -59,9 +139,51 @@ IWRAM_CODE static uint8_t *TrafficGetBuildingiRemainingDensityPointer(int x, int
     return &(traffic_map[oy * CITY_MAP_WIDTH + ox]);
 }
 
+// Start a new search. All tiles are flagged as not visited.
+IWRAM_CODE static void TrafficNewSearch(void)
+{
+    EpochGridNewEpoch(&scratch_epoch);
+
+    BucketQueueInit(&traffic_queue);
+
+    traffic_live_sources = 0;
+}
+
+// Returns the accumulated cost of a tile in the current search, or 0 if it
+// hasn't been visited.
+IWRAM_CODE static int TrafficGetCost(int index)
+{
+    if (!EPOCH_GRID_IS_CURRENT(&scratch_epoch, index))
+        return 0;
+
+    return scratch_map[index];
+}
+
+IWRAM_CODE static void TrafficSetCost(int index, int cost, int parent,
+                                      int owner)
+{
+    EPOCH_GRID_TOUCH(&scratch_epoch, index);
+    scratch_map[index] = cost;
+    path_map[index] = (parent << TRAFFIC_PATH_PARENT_SHIFT) | owner;
+}
+
+// Returns the index of the top left tile of the source that reached a tile in
+// the current search.
+IWRAM_CODE static int TrafficGetOwner(int index)
+{
+    return path_map[index] & TRAFFIC_PATH_OWNER_MASK;
+}
+
+// Returns 1 if the source that reached a tile in the current search still has
+// population that needs to find a destination.
+IWRAM_CODE static int TrafficOwnerIsLive(int index)
+{
+    return traffic_map[TrafficGetOwner(index)] > 0;
+}
+
 // Add initial tiles that are next to a residential building. The only allowed
 // destinations are road and train tracks tiles.
-IWRAM_CODE static void TrafficAddStart(int x, int y)
+IWRAM_CODE static void TrafficAddStart(int x, int y, int owner)
 {
     if ((x < 0) || (x >= CITY_MAP_WIDTH))
         return;
@@ -74,16 +196,21 @@ IWRAM_CODE static void TrafficAddStart(int x, int y)
     if ((type & (TYPE_HAS_ROAD | TYPE_HAS_TRAIN)) == 0)
         return;
 
-    // Add coordinates of destination tile to the queue
-    QueueAddPair(x, y);
+    // If several sources are handled at the same time, the first one that is
+    // next to this tile keeps it.
+    if (TrafficGetCost(y * CITY_MAP_WIDTH + x) == 1)
+        return;
+
+    // Add coordinates of destination tile to the queue with initial cost 1!
+    BucketQueueAdd(&traffic_queue, 1, y * CITY_MAP_WIDTH + x);
 
-    // Set initial cost to 1!
-    scratch_map[y * CITY_MAP_WIDTH + x] = 1;
+    TrafficSetCost(y * CITY_MAP_WIDTH + x, 1, TRAFFIC_PARENT_NONE, owner);
 }
 
 // Try to add a certain tile to the queue. Only non-residential buildings and
 // road/train tracks are allowed.
-IWRAM_CODE static void TrafficAdd(int x, int y, int accumulated_cost)
+IWRAM_CODE static void TrafficAdd(int x, int y, int accumulated_cost,
+                                  int parent, int owner)
 {
     // Check if it is a non-residential building. If so, add to queue
     // immediately.
@@ -97,8 +224,8 @@ IWRAM_CODE static void TrafficAdd(int x, int y, int accumulated_cost)
     // the movement is allowed.
     //
     // In any case, if it is added to the queue, write the accumulated cost up
-    // to this point to the tile as well if it's not a building. If it's a
-    // building it means that we have reached a destination.
+    // to this point to the tile as well. If it's a building it means that we
+    // have reached a destination.
 
     uint16_t type_unmasked = CityMapGetType(x, y);
     uint16_t type = type_unmasked & TYPE_MASK;
@@ -119,19 +246,26 @@ IWRAM_CODE static void TrafficAdd(int x, int y, int accumulated_cost)
             return;
         }
 
-        QueueAddPair(x, y);
+        BucketQueueAdd(&traffic_queue, accumulated_cost,
+                       y * CITY_MAP_WIDTH + x);
 
-        scratch_map[y * CITY_MAP_WIDTH + x] = accumulated_cost;
+        TrafficSetCost(y * CITY_MAP_WIDTH + x, accumulated_cost, parent, owner);
 
         return;
     }
 
-    // Building, add to queue but don't save accumulated cost.
+    // Building, add to queue. Only the cheapest path to each tile of the
+    // building is kept. Paths that aren't cheaper than that one would only
+    // reach the tile after it, when the building is already full or the
+    // source has no population left.
 
-    QueueAddPair(x, y);
+    BucketQueueAdd(&traffic_queue, accumulated_cost, y * CITY_MAP_WIDTH + x);
+
+    TrafficSetCost(y * CITY_MAP_WIDTH + x, accumulated_cost, parent, owner);
 }
 
-IWRAM_CODE static void TrafficTryMoveUp(int x, int y, int accumulated_cost)
+IWRAM_CODE static void TrafficTryMoveUp(int x, int y, int accumulated_cost,
+                                       int owner)
 {
     // Return if this is in the top row
     if (y == 0)
@@ -140,20 +274,24 @@ IWRAM_CODE static void TrafficTryMoveUp(int x, int y, int accumulated_cost)
     // Check if already handled. If so, check if the new cost is lower
     // than the previous one.
 
-    int destination_cost = scratch_map[(y - 1) * CITY_MAP_WIDTH + x];
+    int destination_cost = TrafficGetCost((y - 1) * CITY_MAP_WIDTH + x);
 
     if (destination_cost > 0)
     {
         // This has been handled before. If the cost is lower than the stored one
-        // continue. If not, return.
-        if (destination_cost < accumulated_cost)
+        // continue. If not, return. If the source that got here has already
+        // found destinations for all its population, other sources can use the
+        // tile regardless of the cost.
+        if ((destination_cost <= accumulated_cost) &&
+            TrafficOwnerIsLive((y - 1) * CITY_MAP_WIDTH + x))
             return;
     }
 
-    TrafficAdd(x, y - 1, accumulated_cost);
+    TrafficAdd(x, y - 1, accumulated_cost, TRAFFIC_PARENT_DOWN, owner);
 }
 
-IWRAM_CODE static void TrafficTryMoveDown(int x, int y, int accumulated_cost)
+IWRAM_CODE static void TrafficTryMoveDown(int x, int y, int accumulated_cost,
+                                         int owner)
 {
     // Return if this is in the bottom row
     if (y == (CITY_MAP_HEIGHT - 1))
@@ -162,20 +300,24 @@ IWRAM_CODE static void TrafficTryMoveDown(int x, int y, int accumulated_cost)
     // Check if already handled. If so, check if the new cost is lower
     // than the previous one.
 
-    int destination_cost = scratch_map[(y + 1) * CITY_MAP_WIDTH + x];
+    int destination_cost = TrafficGetCost((y + 1) * CITY_MAP_WIDTH + x);
 
     if (destination_cost > 0)
     {
         // This has been handled before. If the cost is lower than the stored one
-        // continue. If not, return.
-        if (destination_cost < accumulated_cost)
+        // continue. If not, return. If the source that got here has already
+        // found destinations for all its population, other sources can use the
+        // tile regardless of the cost.
+        if ((destination_cost <= accumulated_cost) &&
+            TrafficOwnerIsLive((y + 1) * CITY_MAP_WIDTH + x))
             return;
     }
 
-    TrafficAdd(x, y + 1, accumulated_cost);
+    TrafficAdd(x, y + 1, accumulated_cost, TRAFFIC_PARENT_UP, owner);
 }
 
-IWRAM_CODE static void TrafficTryMoveLeft(int x, int y, int accumulated_cost)
+IWRAM_CODE static void TrafficTryMoveLeft(int x, int y, int accumulated_cost,
+                                         int owner)
 {
     // Return if this is in the left column
     if (x == 0)
@@ -184,20 +326,24 @@ IWRAM_CODE static void TrafficTryMoveLeft(int x, int y, int accumulated_cost)
     // Check if already handled. If so, check if the new cost is lower
     // than the previous one.
 
-    int destination_cost = scratch_map[y * CITY_MAP_WIDTH + (x - 1)];
+    int destination_cost = TrafficGetCost(y * CITY_MAP_WIDTH + (x - 1));
 
     if (destination_cost > 0)
     {
         // This has been handled before. If the cost is lower than the stored one
-        // continue. If not, return.
-        if (destination_cost < accumulated_cost)
+        // continue. If not, return. If the source that got here has already
+        // found destinations for all its population, other sources can use the
+        // tile regardless of the cost.
+        if ((destination_cost <= accumulated_cost) &&
+            TrafficOwnerIsLive(y * CITY_MAP_WIDTH + (x - 1)))
             return;
     }
 
-    TrafficAdd(x - 1, y, accumulated_cost);
+    TrafficAdd(x - 1, y, accumulated_cost, TRAFFIC_PARENT_RIGHT, owner);
 }
 
-IWRAM_CODE static void TrafficTryMoveRight(int x, int y, int accumulated_cost)
+IWRAM_CODE static void TrafficTryMoveRight(int x, int y, int accumulated_cost,
+                                          int owner)
 {
     // Return if this is in the right column
     if (x == (CITY_MAP_WIDTH - 1))
@@ -206,17 +352,20 @@ IWRAM_CODE static void TrafficTryMoveRight(int x, int y, int accumulated_cost)
     // Check if already handled. If so, check if the new cost is lower
     // than the previous one.
 
-    int destination_cost = scratch_map[y * CITY_MAP_WIDTH + (x + 1)];
+    int destination_cost = TrafficGetCost(y * CITY_MAP_WIDTH + (x + 1));
 
     if (destination_cost > 0)
     {
         // This has been handled before. If the cost is lower than the stored one
-        // continue. If not, return.
-        if (destination_cost < accumulated_cost)
+        // continue. If not, return. If the source that got here has already
+        // found destinations for all its population, other sources can use the
+        // tile regardless of the cost.
+        if ((destination_cost <= accumulated_cost) &&
+            TrafficOwnerIsLive(y * CITY_MAP_WIDTH + (x + 1)))
             return;
     }
 
-    TrafficAdd(x + 1, y, accumulated_cost);
+    TrafficAdd(x + 1, y, accumulated_cost, TRAFFIC_PARENT_LEFT, owner);
 }
 
 // From the specified position, get the current accumulated cost, calculate the
@@ -225,7 +374,7 @@ IWRAM_CODE static void TrafficTryMoveRight(int x, int y, int accumulated_cost)
 // considered to be too far for the car/train to get there.
 IWRAM_CODE static void TrafficTryExpand(int x, int y)
 {
-    const int TILE_TRANSPORT_INFO[] = { // Cost
+    static const uint8_t TILE_TRANSPORT_INFO[] = { // Cost
         [T_ROAD_TB]                 = 12,
         [T_ROAD_TB_1]               = 12,
         [T_ROAD_TB_2]               = 12,
@@ -278,8 +427,10 @@ IWRAM_CODE static void TrafficTryExpand(int x, int y)
     // If adding the density to this tile overflows 256, we can't go through
     // this tile, return.
 
+    int owner = TrafficGetOwner(y * CITY_MAP_WIDTH + x);
+
     int current_trafic = traffic_map[y * CITY_MAP_WIDTH + x];
-    int new_traffic = source_building_remaining_density + current_trafic;
+    int new_traffic = traffic_map[owner] + current_trafic;
 
     if (new_traffic > 255)
         return;
@@ -304,121 +455,63 @@ IWRAM_CODE static void TrafficTryExpand(int x, int y)
 
     // The functions will check inside if the tile has already been handled.
 
-    TrafficTryMoveUp(x, y, accumulated_cost);
+    TrafficTryMoveUp(x, y, accumulated_cost, owner);
 
-    TrafficTryMoveRight(x, y, accumulated_cost);
+    TrafficTryMoveRight(x, y, accumulated_cost, owner);
 
-    TrafficTryMoveDown(x, y, accumulated_cost);
+    TrafficTryMoveDown(x, y, accumulated_cost, owner);
 
-    TrafficTryMoveLeft(x, y, accumulated_cost);
+    TrafficTryMoveLeft(x, y, accumulated_cost, owner);
 }
 
-// Checks bounds, returns 255 if outside the map else the accumulated cost
-IWRAM_CODE static int TrafficGetAccumulatedCost(int x, int y)
+// Follow the parents from the specified tile to the source of traffic and
+// increase the traffic of each road or train tracks tile in the path.
+IWRAM_CODE static void TrafficRetrace(int x, int y, int parent,
+                                      int amount_of_traffic)
 {
-    if ((x < 0) || (x >= CITY_MAP_WIDTH) ||
-        (y < 0) || (y >= CITY_MAP_HEIGHT))
+    while (parent != TRAFFIC_PARENT_NONE)
     {
-        // Very high value so that there will always be a smaller one in any
-        // other neighbouring tile
-        return 255;
-    }
-
-    return scratch_map[y * CITY_MAP_WIDTH + x];
-}
+        switch (parent)
+        {
+            case TRAFFIC_PARENT_UP:
+                y--;
+                break;
+            case TRAFFIC_PARENT_DOWN:
+                y++;
+                break;
+            case TRAFFIC_PARENT_LEFT:
+                x--;
+                break;
+            case TRAFFIC_PARENT_RIGHT:
+                x++;
+                break;
+            default:
+                UGBA_Assert(0);
+                return;
+        }
 
-// Recursively find origin of traffic and increase traffic in traffic map.
-IWRAM_CODE static void TrafficRetraceStep(int x, int y, int amount_of_traffic)
-{
-    if ((x < 0) || (x >= CITY_MAP_WIDTH))
-        return;
-    if ((y < 0) || (y >= CITY_MAP_HEIGHT))
-        return;
+        int index = y * CITY_MAP_WIDTH + x;
 
-    uint16_t type = CityMapGetType(x, y);
+        // All tiles in the path are road or train tracks tiles
 
-    if (type & (TYPE_HAS_ROAD | TYPE_HAS_TRAIN))
-    {
-        int result_traffic = traffic_map[y * CITY_MAP_WIDTH + x];
-        result_traffic += amount_of_traffic;
+        int result_traffic = traffic_map[index] + amount_of_traffic;
         if (result_traffic > 255)
             result_traffic = 255;
-        traffic_map[y * CITY_MAP_WIDTH + x] = result_traffic;
-    }
-
-    // If the cost of this tile is 1 it is the initial one, return!
-
-    int scratch = scratch_map[y * CITY_MAP_WIDTH + x];
-    if (scratch == 1)
-        return;
-
-    // This is not the start. Find neighbour with lowest cost in the scratch
-    // map, but that doesn't have cost 0.
+        TrafficMapSet(index, result_traffic);
 
-    int cost_up = TrafficGetAccumulatedCost(x, y - 1);
-    int cost_down = TrafficGetAccumulatedCost(x, y + 1);
-    int cost_left = TrafficGetAccumulatedCost(x - 1, y);
-    int cost_right = TrafficGetAccumulatedCost(x + 1, y);
-
-    if (cost_up == 0)
-        cost_up = 255;
-    if (cost_down == 0)
-        cost_down = 255;
-    if (cost_left == 0)
-        cost_left = 255;
-    if (cost_right == 0)
-        cost_right = 255;
-
-    int cost_min = min(min(cost_up, cost_down), min(cost_left, cost_right));
-
-    int new_x;
-    int new_y;
-
-    if (cost_min == cost_up)
-    {
-        new_x = x;
-        new_y = y - 1;
+        parent = path_map[index] >> TRAFFIC_PATH_PARENT_SHIFT;
     }
-    else if (cost_min == cost_down)
-    {
-        new_x = x;
-        new_y = y + 1;
-    }
-    else if (cost_min == cost_left)
-    {
-        new_x = x - 1;
-        new_y = y;
-    }
-    else if (cost_min == cost_right)
-    {
-        new_x = x + 1;
-        new_y = y;
-    }
-    else
-    {
-        UGBA_Assert(0);
-        return;
-    }
-
-    // Recursive call
-    TrafficRetraceStep(new_x, new_y, amount_of_traffic);
 }
 
-// When calling this function for the first time in the simulation step the
-// caller must ensure that every destination building has its max population
-// density in its top left tile. This function will reduce them as needed so
-// that the next time it is called the previous call would be taken into
-// account.
-//
-// The coordinates given to it are the top left corner of the building.
-IWRAM_CODE static void Simulation_TrafficHandleSource(int x, int y)
+// Add a residential building to the list of sources of traffic. The
+// coordinates given to it are the top left corner of the building.
+IWRAM_CODE static void Simulation_TrafficAddSource(int x, int y)
 {
     // Get density of this building
     // ----------------------------
 
-    // Get the density of this building (source) and save it to a variable
-    // that will be decreased in the queue loop below. This doesn't need to
-    // be saved to the map.
+    // Get the density of this building (source) and add it to the list of
+    // sources. It will be decreased as destinations are found for it.
 
     uint16_t tile = CityMapGetTile(x, y);
     const city_tile_density_info *di = CityTileDensityInfo(tile);
@@ -427,10 +520,6 @@ IWRAM_CODE static void Simulation_TrafficHandleSource(int x, int y)
     if (di->population == 0)
         return;
 
-    // Save it to a variable and start!
-
-    source_building_remaining_density = di->population;
-
     // Get dimensions of this building
     // -------------------------------
 
@@ -445,45 +534,65 @@ IWRAM_CODE static void Simulation_TrafficHandleSource(int x, int y)
     int w = bi->width;
     int h = bi->height;
 
+    traffic_sources[oy] |= (uint64_t)1 << ox;
+
     // Flag as handled (density = 1)
     // -----------------------------
 
-    // The top left tile will be overwritten at the end of this function with
-    // the remaining population to travel (or 0 if everyone reached a valid
-    // destination).
+    // The top left tile holds the remaining population to travel, and it will
+    // keep it at the end of the simulation of the traffic (it will be 0 if
+    // everyone reached a valid destination).
 
     for (int j = oy; j < (oy + h); j++)
     {
         for (int i = ox; i < (ox + w); i++)
-            traffic_map[j * CITY_MAP_WIDTH + i] = 1;
+            TrafficMapSet(j * CITY_MAP_WIDTH + i, 1);
     }
 
-    // Init queue and expansion map
-    // ----------------------------
-
-    QueueInit();
+    TrafficMapSet(oy * CITY_MAP_WIDTH + ox, di->population);
+}
 
-    memset(scratch_map, 0, sizeof(scratch_map));
+// Add neighbours of the source of traffic with the specified top left tile to
+// the queue of the current search.
+IWRAM_CODE static void TrafficSeedSource(int n)
+{
+    int ox = n % CITY_MAP_WIDTH;
+    int oy = n / CITY_MAP_WIDTH;
 
-    // Add neighbours of this building source of traffic to the queue
-    // --------------------------------------------------------------
+    const building_info *bi = Get_BuildingFromBaseTile(CityMapGetTile(ox, oy));
+    int w = bi->width;
+    int h = bi->height;
 
     // Top row
     for (int i = ox; i < (ox + w); i++)
-        TrafficAddStart(i, oy - 1);
+        TrafficAddStart(i, oy - 1, n);
 
     // Bottom row
     for (int i = ox; i < (ox + w); i++)
-        TrafficAddStart(i, oy + h);
+        TrafficAddStart(i, oy + h, n);
 
     // Left column
     for (int j = oy; j < (oy + h); j++)
-        TrafficAddStart(ox - 1, j);
+        TrafficAddStart(ox - 1, j, n);
 
     // Right column
     for (int j = oy; j < (oy + h); j++)
-        TrafficAddStart(ox + w, j);
+        TrafficAddStart(ox + w, j, n);
+
+    traffic_live_sources++;
+}
 
+// When calling this function for the first time in the simulation step the
+// caller must ensure that every destination building has its max population
+// density in its top left tile. This function will reduce them as needed so
+// that the next time it is called the previous call would be taken into
+// account.
+//
+// All the sources added to the current search look for destinations at the
+// same time. Each tile belongs to the source that has reached it with the
+// lowest cost.
+IWRAM_CODE static void TrafficSearch(void)
+{
     // While queue is not empty, expand
     // --------------------------------
 
@@ -505,25 +614,31 @@ IWRAM_CODE static void Simulation_TrafficHandleSource(int x, int y)
         //      - Reduce the source density by that amount or reduce the
         //        destination amount (depending on which one is higher)
 
-        // Check if remaining source density is 0. If so, exit.
-        if (source_building_remaining_density == 0)
+        // Check if the remaining density of all sources is 0. If so, exit.
+        if (traffic_live_sources == 0)
             break;
 
         // Check if there are tiles left to handle. If not, exit.
-        if (QueueIsEmpty())
+        if (BucketQueueIsEmpty(&traffic_queue))
             break;
 
         // Get tile coordinates and type.
 
-        uint16_t ex, ey;
-        QueueGetPair(&ex, &ey);
+        int cost;
+        int index = BucketQueueGet(&traffic_queue, &cost);
+
+        int ex = index % CITY_MAP_WIDTH;
+        int ey = index / CITY_MAP_WIDTH;
 
         uint16_t type = CityMapGetType(ex, ey);
 
         if (type & (TYPE_HAS_ROAD | TYPE_HAS_TRAIN))
         {
-            // This is a road or train tracks. Expand and continue to next tile.
-            TrafficTryExpand(ex, ey);
+            // This is a road or train tracks. Expand and continue to next
+            // tile. There is no need to expand tiles of sources that have
+            // found destinations for all their population.
+            if (TrafficOwnerIsLive(index))
+                TrafficTryExpand(ex, ey);
             continue;
         }
 
@@ -539,6 +654,25 @@ IWRAM_CODE static void Simulation_TrafficHandleSource(int x, int y)
         // get to this building (using the population that has actually arrived
         // to the destination building).
 
+        // The source is the one that owns the tile used to get here
+
+        int parent = path_map[index] >> TRAFFIC_PATH_PARENT_SHIFT;
+        int parent_index = index;
+
+        if (parent == TRAFFIC_PARENT_UP)
+            parent_index -= CITY_MAP_WIDTH;
+        else if (parent == TRAFFIC_PARENT_DOWN)
+            parent_index += CITY_MAP_WIDTH;
+        else if (parent == TRAFFIC_PARENT_LEFT)
+            parent_index -= 1;
+        else if (parent == TRAFFIC_PARENT_RIGHT)
+            parent_index += 1;
+
+        uint8_t *src_density = &traffic_map[TrafficGetOwner(parent_index)];
+
+        if (*src_density == 0)
+            continue;
+
         uint8_t *ptr = TrafficGetBuildingiRemainingDensityPointer(ex, ey);
 
         int remaining_density = *ptr;
@@ -549,33 +683,23 @@ IWRAM_CODE static void Simulation_TrafficHandleSource(int x, int y)
             continue;
         }
 
-        int spent_density =
-                    min(remaining_density, source_building_remaining_density);
+        int spent_density = min(remaining_density, *src_density);
 
         // Subtract from both places
 
         remaining_density -= spent_density;
-        source_building_remaining_density -= spent_density;
+        *src_density -= spent_density;
 
         *ptr = remaining_density;
 
+        if (*src_density == 0)
+            traffic_live_sources--;
+
         // Now, retrace steps to increase traffic of each tile used to get
         // to this building in the TRAFFIC map!
 
-        TrafficRetraceStep(ex, ey, spent_density);
+        TrafficRetrace(ex, ey, parent, spent_density);
     }
-
-    // If there is remaining density, restore it to the source building
-    // ----------------------------------------------------------------
-
-    // This means that the people from this building will be unhappy!
-
-    // The same happens for other buildings, if its final density is not 0 it
-    // means that this building doesn't get all the people it needs for working!
-
-    traffic_map[oy * CITY_MAP_WIDTH + ox] = source_building_remaining_density;
-
-    // End of this building
 }
 
 IWRAM_CODE static void Simulation_TrafficSetTileOkFlag(void)
@@ -589,8 +713,12 @@ IWRAM_CODE static void Simulation_TrafficSetTileOkFlag(void)
 
     simulation_traffic_jam_num_tiles = 0;
 
+    uint64_t *plane = Simulation_HappinessGetPlane(TILE_OK_TRAFFIC_BIT);
+
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
+        uint64_t ok = 0;
+
         for (int i = 0; i < CITY_MAP_WIDTH; i++)
         {
             uint16_t tile, type;
@@ -648,10 +776,10 @@ IWRAM_CODE static void Simulation_TrafficSetTileOkFlag(void)
             }
 
             if (tile_set_flag)
-                Simulation_HappinessSetFlags(i, j, TILE_OK_TRAFFIC);
-            else
-                Simulation_HappinessResetFlags(i, j, TILE_OK_TRAFFIC);
+                ok |= (uint64_t)1 << i;
         }
+
+        plane[j] = ok;
     }
 
     // Check if traffic is too high
@@ -686,39 +814,39 @@ IWRAM_CODE void Simulation_Traffic(void)
     // Clear. Set map to 0 to flag all residential buildings as not handled
     // --------------------------------------------------------------------
 
+    // The tiles that were written will change when the map is cleared, so
+    // they have to be flagged as changed. The density of buildings is reduced
+    // by TrafficSearch() in place, but only in tiles written in the same step.
+
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        traffic_changed[j] |= traffic_written[j];
+        traffic_written[j] = 0;
+    }
+
     memset(traffic_map, 0, sizeof(traffic_map));
-    memset(scratch_map, 0, sizeof(scratch_map));
 
     // Initialize each non-residential building
     // ----------------------------------------
 
     // Get density of each non-residential building and save it in the top left
     // tile of the building. It will be reduced as needed with each call to
-    // Simulation_TrafficHandleSource().
+    // TrafficSearch().
 
-    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
-    {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
-        {
-            uint16_t tile, type;
-            CityMapGetTypeAndTileUnsafe(i, j, &tile, &type);
+    // The building registry doesn't include fields, forests, water or docks
 
-            type &= TYPE_MASK;
+    building_registry_iterator it;
+    building_registry_entry b;
 
-            // Ignored tile types
-            if ((type == TYPE_FIELD) || (type == TYPE_WATER) ||
-                (type == TYPE_RESIDENTIAL) || (type == TYPE_FOREST) ||
-                (type == TYPE_DOCK))
-            {
-                continue;
-            }
+    BuildingRegistryIteratorStart(&it);
 
-            if (BuildingIsCoordinateOrigin(tile))
-            {
-                const city_tile_density_info *info = CityTileDensityInfo(tile);
-                traffic_map[j * CITY_MAP_WIDTH + i] = info->population;
-            }
-        }
+    while (BuildingRegistryIteratorNext(&it, &b))
+    {
+        if ((b.type & TYPE_MASK) == TYPE_RESIDENTIAL)
+            continue;
+
+        const city_tile_density_info *info = CityTileDensityInfo(b.tile);
+        TrafficMapSet(b.y * CITY_MAP_WIDTH + b.x, info->population);
     }
 
     // For each tile check if it is a residential building
@@ -739,26 +867,84 @@ IWRAM_CODE void Simulation_Traffic(void)
     // sense.
 
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+        traffic_sources[j] = 0;
+
+    BuildingRegistryIteratorStart(&it);
+
+    while (BuildingRegistryIteratorNext(&it, &b))
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        // If not residential, skip
+        if (b.type != TYPE_RESIDENTIAL)
+            continue;
+
+        // Residential building = Source of traffic
+
+        // Check if handled. If so, skip
+        int val = traffic_map[b.y * CITY_MAP_WIDTH + b.x];
+        if (val != 0)
+            continue;
+
+        Simulation_TrafficAddSource(b.x, b.y);
+    }
+
+    // Look for destinations
+    // ---------------------
+
+    if (traffic_batched)
+    {
+        // Look for destinations for all sources at the same time. Some
+        // sources may not find enough destinations because other sources get
+        // to them first, so the population left is handled below.
+
+        TrafficNewSearch();
+
+        for (int j = 0; j < CITY_MAP_HEIGHT; j++)
         {
-            uint16_t type = CityMapGetType(i, j);
+            uint64_t sources = traffic_sources[j];
 
-            // If not residential, skip
-            if (type != TYPE_RESIDENTIAL)
-                continue;
+            while (sources != 0)
+            {
+                int i = __builtin_ctzll(sources);
+                sources &= sources - 1;
 
-            // Residential building = Source of traffic
+                TrafficSeedSource(j * CITY_MAP_WIDTH + i);
+            }
+        }
+
+        TrafficSearch();
+    }
+
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        uint64_t sources = traffic_sources[j];
 
-            // Check if handled. If so, skip
-            int val = traffic_map[j * CITY_MAP_WIDTH + i];
-            if (val != 0)
+        while (sources != 0)
+        {
+            int i = __builtin_ctzll(sources);
+            sources &= sources - 1;
+
+            int n = j * CITY_MAP_WIDTH + i;
+
+            if (traffic_map[n] == 0)
                 continue;
 
-            Simulation_TrafficHandleSource(i, j);
+            TrafficNewSearch();
+            TrafficSeedSource(n);
+            TrafficSearch();
         }
     }
 
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+        traffic_changed[j] |= traffic_written[j];
+
+    // If there is remaining density, it stays in the source building
+    // --------------------------------------------------------------
+
+    // This means that the people from this building will be unhappy!
+
+    // The same happens for other buildings, if its final density is not 0 it
+    // means that this building doesn't get all the people it needs for working!
+
     // Update tiles of the map to show the traffic level
     // -------------------------------------------------
 
@@ -834,14 +1020,56 @@ IWRAM_CODE void Simulation_TrafficRemoveAnimationTiles(void)
     }
 }
 
+// Bitboard with one bit per tile. A bit is set if that tile is a road with
+// traffic animation. It is always up to date.
+EWRAM_BSS static uint64_t traffic_anim_tiles[CITY_MAP_HEIGHT];
+
+static int TrafficAnimIsAnimated(uint16_t tile)
+{
+    return (tile == T_ROAD_TB_1) || (tile == T_ROAD_TB_2) ||
+           (tile == T_ROAD_TB_3) || (tile == T_ROAD_LR_1) ||
+           (tile == T_ROAD_LR_2) || (tile == T_ROAD_LR_3);
+}
+
+void TrafficAnimRefresh(void)
+{
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        uint64_t row = 0;
+
+        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        {
+            if (TrafficAnimIsAnimated(CityMapGetTile(i, j)))
+                row |= (uint64_t)1 << i;
+        }
+
+        traffic_anim_tiles[j] = row;
+    }
+}
+
+IWRAM_CODE void TrafficAnimUpdate(int x, int y, uint16_t tile)
+{
+    uint64_t bit = (uint64_t)1 << x;
+
+    if (TrafficAnimIsAnimated(tile))
+        traffic_anim_tiles[y] |= bit;
+    else
+        traffic_anim_tiles[y] &= ~bit;
+}
+
 IWRAM_CODE void Simulation_TrafficAnimate(void)
 {
     // Animate tiles of the map with traffic animation
 
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
-        for (int i = 0; i < CITY_MAP_WIDTH; i++)
+        uint64_t row = traffic_anim_tiles[j];
+
+        while (row != 0)
         {
+            int i = __builtin_ctzll(row);
+            row &= row - 1;
+
             uint16_t tile = CityMapGetTile(i, j);
 
             if ((tile == T_ROAD_TB_1) || (tile == T_ROAD_TB_2) ||
@@ -849,8 +1077,7 @@ IWRAM_CODE void Simulation_TrafficAnimate(void)
             {
                 CityMapToggleVFlip(i, j);
             }
-            else if ((tile == T_ROAD_LR_1) || (tile == T_ROAD_LR_2) ||
-                     (tile == T_ROAD_LR_3))
+            else
             {
                 CityMapToggleHFlip(i, j);
             }
@@ -2,21 +2,73 @@
 //
 // Copyright (c) 2021, Antonio Niño Díaz
 
+#include <stdint.h>
 #include <stdlib.h>
 
+#include <ugba/ugba.h>
+
 #include "random.h"
 #include "room_game/draw_common.h"
 #include "room_game/room_game.h"
 #include "room_game/tileset_info.h"
+#include "simulation/water.h"
+
+#if CITY_MAP_WIDTH != 64
+#error "Each row of the water bitboard must fit in a 64-bit word"
+#endif
 
-void Simulation_WaterAnimate(void)
+// Bitboard with one bit per tile. A bit is set if that tile is animated water.
+// It is always up to date.
+EWRAM_BSS static uint64_t water_tiles[CITY_MAP_HEIGHT];
+
+static int WaterAnimIsAnimated(uint16_t tile)
 {
-    int count = (rand_fast() & 31) + 1;
+    return (tile == T_WATER) || (tile == T_WATER_EXTRA);
+}
 
+void WaterAnimRefresh(void)
+{
     for (int j = 0; j < CITY_MAP_HEIGHT; j++)
     {
+        uint64_t row = 0;
+
         for (int i = 0; i < CITY_MAP_WIDTH; i++)
         {
+            if (WaterAnimIsAnimated(CityMapGetTile(i, j)))
+                row |= (uint64_t)1 << i;
+        }
+
+        water_tiles[j] = row;
+    }
+}
+
+IWRAM_CODE void WaterAnimUpdate(int x, int y, uint16_t tile)
+{
+    uint64_t bit = (uint64_t)1 << x;
+
+    if (WaterAnimIsAnimated(tile))
+        water_tiles[y] |= bit;
+    else
+        water_tiles[y] &= ~bit;
+}
+
+IWRAM_CODE void Simulation_WaterAnimate(void)
+{
+    // Only water tiles are counted, so the same fraction of the water of the
+    // map is animated each time regardless of the size of the rest of the
+    // city, and the cost of the function depends on the amount of water.
+
+    int count = (rand_fast() & 31) + 1;
+
+    for (int j = 0; j < CITY_MAP_HEIGHT; j++)
+    {
+        uint64_t row = water_tiles[j];
+
+        while (row != 0)
+        {
+            int i = __builtin_ctzll(row);
+            row &= row - 1;
+
             if (count > 0)
             {
                 count--;
@@ -25,10 +77,9 @@ void Simulation_WaterAnimate(void)
 
             count = (rand_fast() & 31) + 1;
 
-            uint16_t tile = CityMapGetTile(i, j);
-            if (tile == T_WATER)
+            if (CityMapGetTile(i, j) == T_WATER)
                 CityMapDrawTile(T_WATER_EXTRA, i, j);
-            else if (tile == T_WATER_EXTRA)
+            else
                 CityMapDrawTile(T_WATER, i, j);
         }
     }
@@ -5,6 +5,13 @@
 #ifndef SIMULATION_WATER_H__
 #define SIMULATION_WATER_H__
 
+#include <stdint.h>
+
+// Rebuild the list of animated water tiles from the map
+void WaterAnimRefresh(void);
+// Update the list of animated water tiles after drawing the specified tile
+void WaterAnimUpdate(int x, int y, uint16_t tile);
+
 void Simulation_WaterAnimate(void);
 
 #endif // SIMULATION_WATER_H__